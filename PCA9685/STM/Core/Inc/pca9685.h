@@ -14,8 +14,30 @@
 // Registres et constantes (cycles de 20ms, clock à 25MHz)
 
 #define PCA_I2C_ADDR        0x80   //  Adresse par défaut
-#define PCA_I2C_TIMEOUT     1.0f   //  Durée du timeout
-#define PCA_PRESCALER_FREQ  46.0f  //  Fréquence voulue
+#define PCA_ALLCALL_ADDR    0xe0   //  Adresse All Call (toutes les cartes du bus)
+#define PCA_I2C_TIMEOUT     10     //  Durée max d'un transfert (ms), 66 octets à 100kHz : 6ms
+#define PCA_I2C_GPIO        GPIOA        //  Port des broches de l'I2C1
+#define PCA_SCL_PIN         GPIO_PIN_9   //  SCL (PA9)
+#define PCA_SDA_PIN         GPIO_PIN_10  //  SDA (PA10)
+#define PCA_MAX_BOARDS      62     //  Cartes suivies (62 adresses possibles sur un bus)
+#define PCA_PRESCALER_FREQ  46.0f  //  Fréquence à demander avec un oscillateur de 25MHz pour obtenir PCA_PWM_CYCLE_TIME
+#define PCA_OSC_FREQ        ((uint32_t) (25000000.0f * 1000 / (PCA_PWM_CYCLE_TIME * PCA_PRESCALER_FREQ))) // Oscillateur interne réel
+#define PCA_EXTCLK_FREQ     0      //  Fréquence de l'horloge externe sur EXTCLK (0 : oscillateur interne)
+#define PCA_PRESCALER_MIN   3      //  Valeur minimale du registre PRE_SCALE (cf. page 25)
+
+#define PCA_USE_DMA         1      //  Ecritures non bloquantes (file de transferts DMA)
+#define PCA_QUEUE_SIZE      8      //  Nombre de transferts en attente (une case reste libre)
+#define PCA_QUEUE_TIMEOUT   100    //  Durée max (ms) pour vider la file dans PCA9685_wait
+
+#define PCA_I2C_SPEED       100000 //  Fréquence du bus (100000, 400000 ou 1000000 Hz)
+#define PCA_SCRUB_PERIOD    50     //  Durée min (ms) entre deux lectures de PCA9685_scrub (0 : désactivé)
+#define PCA_SCRUB_CHUNK     16     //  Octets de channels lus par lecture (diviseur de 64)
+#define PCA_MEASURE         0      //  Mesurer la durée des transferts (PCA9685_get_stats)
+
+#define PCA_STAGGER         0      //  Décaler le passage à l'état haut de chaque channel (PCA9685_set_stagger)
+#define PCA_STAGGER_STEP    (4096 / PCA_CHANNEL_COUNT) // Décalage entre deux channels (comptes)
+
+#define PCA_AUTO_FLUSH      1      //  Envoyer les channels modifiés à chaque appel (sinon une fois par cycle par PCA9685_poll)
 
 #define PCA_PWM_MIN_TIME    0.8f   // 205 pour un cycle de 20ms
 #define PCA_PWM_MAX_TIME    2.2f   // 409 pour un cycle de 20ms
@@ -25,12 +47,33 @@
 #define PCA_PWM_MIN         ((uint16_t) (PCA_PWM_MIN_TIME/(PCA_PWM_CYCLE_TIME/4096)))
 #define PCA_PWM_RANGE       (PCA_PWM_MAX - PCA_PWM_MIN)
 
+#define PCA_Q15_ONE         0x8000 // Setpoint Q15 de 1.0 (cycle maximal)
+
+#define PCA_CALIB_ADDR      0x0803F800 // Dernière page de flash (réservée dans STM32L432KCUX_FLASH.ld)
+#define PCA_CALIB_SLOTS     15         // Cartes enregistrées dans la page (A5..A0 = 0 à 14), 2 Ko / sizeof(PCA9685_CalibSlot)
+#define PCA_CALIB_MAGIC     0x43413936 // Marque d'un emplacement valide
+
 #define PCA_REG_MODE1       0x00
 #define PCA_REG_MODE2       0x01
+#define PCA_REG_SUBADR1     0x02
+#define PCA_REG_CHAN0_ON_L  0x06
 #define PCA_REG_CHAN0_OFF_L 0x08
 #define PCA_REG_ALL_ON_L    0xfa
 #define PCA_REG_PRESCALER   0xfe
 
+#define PCA_MODE1_RESTART   0x80   // Relance des channels après le sleep mode
+#define PCA_MODE1_EXTCLK    0x40   // Horloge externe (activé en sleep mode, jusqu'au reset)
+#define PCA_MODE1_AI        0x20   // Auto-increment
+#define PCA_MODE1_SLEEP     0x10   // Oscillateur arrêté
+#define PCA_MODE1_SUB1      0x08   // Réponse à la sous-adresse 1
+#define PCA_MODE1_ALLCALL   0x01   // Réponse à l'adresse All Call
+
+#define PCA_CHANNEL_COUNT   16     // Nombre de sorties PWM
+#define PCA_CHANNEL_SIZE    4      // Registres par sortie (ON_L, ON_H, OFF_L, OFF_H)
+#define PCA_MAX_DATA_LEN    (PCA_CHANNEL_COUNT*PCA_CHANNEL_SIZE)
+#define PCA_DIRTY_ALL       (~0ULL) // Tous les octets des registres LEDn_ON/OFF à renvoyer
+#define PCA_WRITE_OVERHEAD  2      // Octets d'une écriture en plus des données (adresse et registre)
+
 // Codes d'erreur
 
 #define PCA_ERR_INIT_RESET      0x01
@@ -46,13 +89,165 @@
 #define PCA_ERR_CYCLE_TOO_BIG   0x11
 #define PCA_ERR_DATA_TOO_SMALL  0x12
 #define PCA_ERR_DATA_TOO_BIG    0x13
+#define PCA_ERR_QUEUE_FULL      0x14
+#define PCA_ERR_QUEUE_TIMEOUT   0x15
+#define PCA_ERR_SUBADDR         0x16
+#define PCA_ERR_CALIB_INVALID   0x17
+#define PCA_ERR_CALIB_SLOT      0x18
+#define PCA_ERR_CALIB_EMPTY     0x19
+#define PCA_ERR_CALIB_FLASH     0x20
+#define PCA_ERR_SPEED           0x21
+#define PCA_ERR_RECOVER         0x22
+#define PCA_ERR_STATE           0x23
+#define PCA_ERR_FREQ            0x24
+#define PCA_ERR_BOARDS          0x25
+
+// Calibration d'un servomoteur (8 octets, programmés en un double mot de flash)
+
+typedef struct {
+	uint16_t min_us;                    // Impulsion pour un setpoint nul
+	uint16_t max_us;                    // Impulsion pour un setpoint maximal
+	uint16_t neutral_us;                // Impulsion pour la position neutre
+	uint16_t invert;                    // 1 pour inverser le sens du servomoteur
+} PCA9685_Calib;
+
+// Emplacement d'une carte dans la page de calibration
+
+typedef struct {
+	uint32_t magic;                     // PCA_CALIB_MAGIC si l'emplacement est valide
+	uint32_t reserved;
+	PCA9685_Calib calib[PCA_CHANNEL_COUNT];
+} PCA9685_CalibSlot;
+
+// Conversion d'un setpoint Q15 en compte : offset + (value * range) >> 15
+
+typedef struct {
+	uint16_t offset;                    // Compte pour un setpoint nul
+	int16_t range;                      // Comptes pour PCA_Q15_ONE (négatif si inversé)
+	uint16_t neutral;                   // Compte de la position neutre
+} PCA9685_Scale;
+
+// Etats de l'initialisation d'une carte
+
+#define PCA_STATE_RESET     0      // Pas encore initialisée
+#define PCA_STATE_INIT      1      // Ecritures d'initialisation en cours
+#define PCA_STATE_SETTLE    2      // Attente de la stabilisation de l'oscillateur
+#define PCA_STATE_READY     3      // Prête à être pilotée
+#define PCA_STATE_ERROR     4      // Une écriture d'initialisation a échoué
+#define PCA_STATE_SLEEP     5      // En veille (PCA9685_sleep), registres des channels gardés
+#define PCA_STATE_WAKE      6      // Sortie de veille, attente de l'oscillateur avant RESTART
+
+#define PCA_INIT_STEPS      6      // Ecritures de l'initialisation (MODE1, EXTCLK, MODE2, ALL_LED, PRE_SCALE, MODE1)
+
+struct PCA9685_Handle;
+typedef void (*PCA9685_Callback)(struct PCA9685_Handle *pca, int status);
+
+// Une carte PCA9685 (plusieurs cartes peuvent partager le même bus I2C)
+
+typedef struct PCA9685_Handle {
+	I2C_HandleTypeDef *i2c;             // Bus I2C (généralement &hi2c1)
+	uint16_t addr;                      // Adresse I2C décalée (PCA_I2C_ADDR + A5..A0)
+	uint8_t mode1;                      // Valeur du registre MODE1 (hors SLEEP)
+	uint8_t prescaler;                  // Valeur du registre PRE_SCALE
+	uint16_t cycle_us;                  // Durée d'un cycle PWM (µs)
+	uint32_t osc_hz;                    // Fréquence de l'oscillateur (interne ou EXTCLK)
+	uint8_t stagger;                    // Phase ON décalée de PCA_STAGGER_STEP par channel
+	PCA9685_Calib calib[PCA_CHANNEL_COUNT]; // Calibration de chaque channel
+	PCA9685_Scale scale[PCA_CHANNEL_COUNT]; // Conversion de chaque channel (calculée depuis calib)
+	uint8_t shadow[PCA_MAX_DATA_LEN];   // Copie des registres LEDn_ON/OFF
+	uint64_t dirty;                     // Octets de shadow à renvoyer (un bit par registre)
+	uint32_t frame_us;                  // Temps écoulé dans le cycle PWM (compté par PCA9685_tick)
+	volatile uint8_t frame_due;         // Cycle écoulé, cache à envoyer par PCA9685_poll
+	volatile uint8_t state;             // PCA_STATE_*
+	volatile uint8_t pending;           // Une écriture d'initialisation est dans la file
+	volatile uint8_t init_step;         // Prochaine étape de l'initialisation (0 à PCA_INIT_STEPS)
+	volatile uint8_t init_error;        // Code d'erreur de l'étape qui a échoué (0 sinon)
+	uint32_t settle_tick;               // HAL_GetTick() à la fin des écritures d'initialisation
+	PCA9685_Callback on_ready;          // Appelée à la fin de l'initialisation (ou NULL)
+} PCA9685_Handle;
+
+// Plusieurs cartes qui répondent à la même adresse (All Call ou sous-adresse)
+
+typedef struct {
+	I2C_HandleTypeDef *i2c;             // Bus I2C partagé par les cartes
+	uint16_t addr;                      // PCA_ALLCALL_ADDR ou une sous-adresse
+	PCA9685_Handle **boards;            // Cartes du groupe (pour mettre à jour leur cache)
+	uint8_t board_count;
+} PCA9685_Group;
+
+// Compteurs d'erreurs I2C
+
+typedef struct {
+	uint32_t nack;                      // Pas de réponse (carte absente)
+	uint32_t bus;                       // Erreur de bus ou arbitrage perdu
+	uint32_t timeout;                   // Transfert plus long que PCA_I2C_TIMEOUT
+	uint32_t stuck;                     // SDA maintenu à l'état bas bus au repos
+	uint32_t other;                     // Autres erreurs HAL (DMA, overrun)
+	uint32_t dropped;                   // Transferts abandonnés
+	uint32_t recoveries;                // Libérations du bus (PCA9685_recover)
+	uint32_t scrubbed;                  // Octets de channels corrigés par PCA9685_scrub
+	uint32_t resets;                    // Cartes redémarrées détectées par PCA9685_scrub
+} PCA9685_Errors;
+
+// Mesures de durée des transferts (PCA_MEASURE)
+
+typedef struct {
+	uint32_t transfers;                 // Nombre de transferts mesurés
+	uint32_t last_us;                   // Durée du dernier transfert (µs)
+	uint32_t max_us;                    // Durée maximale d'un transfert (µs)
+	uint32_t channel_us;                // Durée par channel de la dernière écriture LEDn_ON/OFF (µs)
+	uint8_t last_len;                   // Taille du dernier transfert (octets, hors adresse)
+} PCA9685_Stats;
 
 // Signatures des fonctions publiques
 
-int PCA9685_init(I2C_HandleTypeDef *i2c);
-int PCA9685_turn_off(I2C_HandleTypeDef *i2c, uint8_t channel);
-int PCA9685_set_pwm(I2C_HandleTypeDef *i2c, uint8_t channel, float points);
-int PCA9685_set_cycle(I2C_HandleTypeDef *i2c, uint8_t channel, float duty_cycle);
+int PCA9685_init(PCA9685_Handle *pca, I2C_HandleTypeDef *i2c, uint16_t addr);
+int PCA9685_init_async(PCA9685_Handle *pca, I2C_HandleTypeDef *i2c, uint16_t addr, PCA9685_Callback on_ready);
+int PCA9685_get_state(PCA9685_Handle *pca);
+void PCA9685_tick(void);
+void PCA9685_poll(void);
+int PCA9685_sleep(PCA9685_Handle *pca);
+int PCA9685_resume(PCA9685_Handle *pca);
+int PCA9685_set_frequency(PCA9685_Handle *pca, uint16_t hz);
+int PCA9685_write(PCA9685_Handle *pca, uint8_t reg, uint8_t val);
+int PCA9685_write_data(PCA9685_Handle *pca, uint8_t reg, uint8_t *data, uint8_t data_len);
+int PCA9685_turn_off(PCA9685_Handle *pca, uint8_t channel);
+int PCA9685_turn_on(PCA9685_Handle *pca, uint8_t channel);
+int PCA9685_set_stagger(PCA9685_Handle *pca, uint8_t enable);
+int PCA9685_set_pwm(PCA9685_Handle *pca, uint8_t channel, float points);
+int PCA9685_set_cycle(PCA9685_Handle *pca, uint8_t channel, float duty_cycle);
+int PCA9685_stage_q15(PCA9685_Handle *pca, uint8_t channel, uint16_t value);
+int PCA9685_set_q15(PCA9685_Handle *pca, uint8_t channel, uint16_t value);
+int PCA9685_set_q15_range(PCA9685_Handle *pca, uint8_t first, uint8_t count, const uint16_t values[]);
+int PCA9685_set_pwm_range(PCA9685_Handle *pca, uint8_t first, uint8_t count, const uint16_t points[]);
+int PCA9685_flush(PCA9685_Handle *pca);
+
+int PCA9685_set_neutral(PCA9685_Handle *pca, uint8_t channel);
+int PCA9685_set_calib(PCA9685_Handle *pca, uint8_t channel, const PCA9685_Calib *calib);
+int PCA9685_calib_load(PCA9685_Handle *pca, uint8_t slot);
+int PCA9685_calib_save(PCA9685_Handle *pca, uint8_t slot);
+
+int PCA9685_set_pwm_all(PCA9685_Handle *pca, uint16_t points);
+int PCA9685_turn_off_all(PCA9685_Handle *pca);
+int PCA9685_set_subaddr(PCA9685_Handle *pca, uint8_t sub, uint16_t addr);
+int PCA9685_group_set_pwm_all(PCA9685_Group *group, uint16_t points);
+int PCA9685_group_turn_off_all(PCA9685_Group *group);
+
+int PCA9685_set_speed(I2C_HandleTypeDef *i2c, uint32_t speed);
+
+int PCA9685_recover(I2C_HandleTypeDef *i2c);
+int PCA9685_check_bus(I2C_HandleTypeDef *i2c);
+int PCA9685_scrub(I2C_HandleTypeDef *i2c);
+
+int PCA9685_queue_idle(void);
+int PCA9685_wait(uint32_t timeout);
+
+extern volatile PCA9685_Errors PCA9685_errors;
+
+#if PCA_MEASURE
+void PCA9685_get_stats(PCA9685_Stats *out);
+void PCA9685_reset_stats(void);
+#endif
 
 
 #endif
@@ -0,0 +1,60 @@
+/*!
+ *  @version 1.0
+ *  @file    pca9685_motion.h
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Fichier d'entête pour les profils de mouvement des servomoteurs d'un PCA9685
+ */
+
+#ifndef PCA9685_MOTION_H
+#define PCA9685_MOTION_H
+
+#include "pca9685.h"
+
+// Constantes
+
+#define PCA_MOTION_BOARDS   4      // Nombre de cartes mises à jour par PCA9685_motion_poll
+#define PCA_MOTION_FRAC     4      // Bits après la virgule des positions (Q15 << PCA_MOTION_FRAC)
+
+// Codes d'erreur
+
+#define PCA_ERR_MOTION_FULL     0x30
+#define PCA_ERR_MOTION_DISABLED 0x31
+
+// Trajectoire d'un servomoteur, les grandeurs sont en (Q15 << PCA_MOTION_FRAC) par frame PWM
+
+typedef struct {
+	volatile uint16_t target;           // Position visée (Q15, modifiée par PCA9685_motion_move)
+	int32_t pos;                        // Position actuelle
+	int32_t vel;                        // Vitesse actuelle (par frame)
+	int32_t acc;                        // Accélération actuelle (par frame²)
+	int32_t max_vel;                    // Vitesse maximale (0 : saut direct à la cible)
+	int32_t max_acc;                    // Accélération maximale (0 : vitesse constante)
+	int32_t max_jerk;                   // Jerk maximal (0 : profil trapézoïdal, sinon courbe en S)
+	uint8_t enabled;                    // Channel piloté par le moteur de mouvement
+} PCA9685_Axis;
+
+// Trajectoires de tous les channels d'une carte
+
+typedef struct {
+	PCA9685_Handle *pca;
+	PCA9685_Axis axis[PCA_CHANNEL_COUNT];
+	uint16_t frame_ms;                  // Durée d'une frame PWM (ms)
+	uint16_t elapsed_ms;                // Temps écoulé depuis la dernière mise à jour
+	volatile uint8_t due;               // Frame écoulée, à calculer par PCA9685_motion_poll
+} PCA9685_Motion;
+
+// Signatures des fonctions publiques
+
+int PCA9685_motion_attach(PCA9685_Motion *motion, PCA9685_Handle *pca);
+int PCA9685_motion_config(PCA9685_Motion *motion, uint8_t channel, uint16_t position,
+		int32_t max_vel, int32_t max_acc, int32_t max_jerk);
+int PCA9685_motion_move(PCA9685_Motion *motion, uint8_t channel, uint16_t target);
+int PCA9685_motion_done(PCA9685_Motion *motion, uint8_t channel);
+
+int PCA9685_motion_update(PCA9685_Motion *motion);
+void PCA9685_motion_tick(void);
+void PCA9685_motion_poll(void);
+
+
+#endif
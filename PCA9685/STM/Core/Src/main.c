@@ -22,6 +22,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "pca9685.h"
+#include "pca9685_motion.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -42,6 +43,8 @@
 I2C_HandleTypeDef hi2c1;
 
 /* USER CODE BEGIN PV */
+PCA9685_Handle pca;
+PCA9685_Motion motion;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -93,14 +96,17 @@ int main(void)
   HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
 
   // Initialisation et envoi d'un signal PWM
-  PCA9685_init(&hi2c1);
-  PCA9685_set_cycle(&hi2c1, 0, 1.0f);
+  PCA9685_init(&pca, &hi2c1, PCA_I2C_ADDR);
+  PCA9685_set_cycle(&pca, 0, 1.0f);
 
   // Fin du trigger
   HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
 
-  float i = 0.0f;
-  float increment = 4.0f;
+  // Aller-retour du channel 0 : trapèze à 1/64 de la course par frame au maximum,
+  // vitesse atteinte en 8 frames
+  PCA9685_motion_attach(&motion, &pca);
+  PCA9685_motion_config(&motion, 0, PCA_Q15_ONE,
+      (PCA_Q15_ONE / 64) << PCA_MOTION_FRAC, (PCA_Q15_ONE / 512) << PCA_MOTION_FRAC, 0);
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -108,13 +114,19 @@ int main(void)
 
   while (1)
   {
-    PCA9685_set_pwm(&hi2c1, 0, i);
-    i += increment;
+    // Libère le bus si une carte le bloque et renvoie l'état des cartes
+    PCA9685_check_bus(&hi2c1);
 
-    if (i > PCA_PWM_RANGE || i < 0)
-      increment *= -1;
+    // Relit les cartes quand le bus est libre et corrige les registres perdus
+    PCA9685_scrub(&hi2c1);
 
-    HAL_Delay(20);
+    // SysTick_Handler compte le temps, les initialisations avancent et les caches sont envoyés ici
+    PCA9685_poll();
+    PCA9685_motion_poll();
+
+    // On choisit seulement la cible suivante
+    if (PCA9685_motion_done(&motion, 0))
+      PCA9685_motion_move(&motion, 0, motion.axis[0].target == 0 ? PCA_Q15_ONE : 0);
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -209,7 +221,11 @@ static void MX_I2C1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN I2C1_Init 2 */
-
+  // Remplace le timing 100kHz de CubeMX par celui de PCA_I2C_SPEED
+  if (PCA9685_set_speed(&hi2c1, PCA_I2C_SPEED) != 0)
+  {
+    Error_Handler();
+  }
   /* USER CODE END I2C1_Init 2 */
 
 }
@@ -6,141 +6,2089 @@
  *  @brief   Code source pour contrôler un PCA9685
  */
 
-#include <math.h>
 #include <string.h>
 #include "pca9685.h"
 
 
-// Identique à Arduino : https://www.arduino.cc/reference/en/language/functions/math/map/
-uint16_t map(float x, float in_min, float in_max, float out_min, float out_max) {
-  return (uint16_t) ((x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min);
+#if PCA_MEASURE
+static PCA9685_Stats stats;
+
+
+/*!
+ *  @brief Démarrer le compteur de cycles du CPU (DWT) pour les mesures
+ */
+static void PCA9685_measure_init(void) {
+	if (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)
+		return;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 
 /*!
- *  @brief Ecrire dans un seul registre (cf. page 32)
+ *  @brief Enregistrer la durée d'un transfert terminé
+ *  @param start La valeur de DWT->CYCCNT au début du transfert
+ *  @param data Le transfert (octet de registre suivi des données)
+ *  @param len La taille du transfert
+ */
+static void PCA9685_measure_done(uint32_t start, const uint8_t *data, uint8_t len) {
+	uint32_t us = (DWT->CYCCNT - start) / (SystemCoreClock / 1000000);
+
+	stats.transfers++;
+	stats.last_us = us;
+	stats.last_len = len;
+	if (us > stats.max_us)
+		stats.max_us = us;
+
+	// Durée ramenée à un channel pour les écritures des registres LEDn_ON/OFF
+	uint8_t channels = (len - 1) / PCA_CHANNEL_SIZE;
+	if (data[0] >= PCA_REG_CHAN0_ON_L && data[0] < PCA_REG_ALL_ON_L && channels > 0)
+		stats.channel_us = us / channels;
+}
+#endif
+
+
+volatile PCA9685_Errors PCA9685_errors;
+
+// Cartes initialisées : initialisation, envoi par cycle, vérification et réécriture après une libération du bus
+static PCA9685_Handle *handles[PCA_MAX_BOARDS];
+static uint8_t handle_count = 0;
+static uint8_t recovering = 0;
+
+
+/*!
+ *  @brief Compter une erreur I2C selon son code HAL
+ *  @param code Le code d'erreur (i2c->ErrorCode)
+ *  @return 1 si le bus doit être libéré (PCA9685_recover), 0 sinon
+ */
+static int PCA9685_count_error(uint32_t code) {
+	if (code & HAL_I2C_ERROR_TIMEOUT) {
+		PCA9685_errors.timeout++;
+		return 1;
+	}
+
+	if (code & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO)) {
+		PCA9685_errors.bus++;
+		return 1;
+	}
+
+	// Pas de réponse : carte absente ou adresse fausse, le bus n'est pas bloqué
+	if (code & HAL_I2C_ERROR_AF) {
+		PCA9685_errors.nack++;
+		return 0;
+	}
+
+	PCA9685_errors.other++;
+	return 0;
+}
+
+
+/*!
+ *  @brief Code d'erreur d'une étape d'initialisation
+ *  @param step L'étape (0 à PCA_INIT_STEPS - 1)
+ *  @return Le code PCA_ERR_INIT_*
+ */
+static int PCA9685_init_code(uint8_t step) {
+	static const uint8_t codes[PCA_INIT_STEPS] = {
+		PCA_ERR_INIT_SLEEP, PCA_ERR_INIT_SLEEP, PCA_ERR_INIT_MODE2,
+		PCA_ERR_INIT_RESET, PCA_ERR_INIT_PRESCALER, PCA_ERR_INIT_WAKEUP
+	};
+
+	return codes[step < PCA_INIT_STEPS ? step : PCA_INIT_STEPS - 1];
+}
+
+
+// Lance l'écriture d'initialisation suivante (définie avec PCA9685_init_async)
+static int PCA9685_init_next(PCA9685_Handle *pca);
+
+
+/*!
+ *  @brief Terminer une écriture d'initialisation et lancer la suivante
+ *  @param owner La carte (NULL si le transfert n'est pas suivi)
+ *  @param error Le transfert a échoué
+ *
+ *  Appelée à la fin du transfert (callback DMA) : la carte n'a jamais plus d'une
+ *  écriture d'initialisation dans la file. Après la dernière, elle attend que son
+ *  oscillateur se stabilise (PCA_STATE_SETTLE) ou passe en erreur
+ */
+static void PCA9685_transfer_done(PCA9685_Handle *owner, uint32_t error) {
+	if (owner == NULL)
+		return;
+
+	owner->pending = 0;
+
+	int status = 0;
+	if (error)
+		status = PCA9685_init_code(owner->init_step - 1);
+	else if (owner->init_step < PCA_INIT_STEPS)
+		status = PCA9685_init_next(owner);
+	else {
+		owner->settle_tick = HAL_GetTick();
+		owner->state = PCA_STATE_SETTLE;
+	}
+
+	if (status == 0 || owner->state == PCA_STATE_ERROR)
+		return;
+
+	owner->init_error = status;
+	owner->state = PCA_STATE_ERROR;
+	if (owner->on_ready)
+		owner->on_ready(owner, status);
+}
+
+
+#if PCA_USE_DMA
+// Un transfert en attente : octet de registre suivi des données
+typedef struct {
+	PCA9685_Handle *owner;              // Carte à prévenir à la fin (initialisation)
+	I2C_HandleTypeDef *i2c;
+	uint16_t addr;
+	uint8_t len;
+	uint8_t data[PCA_MAX_DATA_LEN + 1];
+} PCA9685_Transfer;
+
+static PCA9685_Transfer queue[PCA_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;  // Prochaine case libre
+static volatile uint8_t queue_tail = 0;  // Transfert en cours (ou prochain à envoyer)
+static volatile uint8_t queue_busy = 0;  // Un transfert DMA est en cours
+static volatile uint8_t queue_fault = 0; // Erreur de bus : file arrêtée jusqu'à PCA9685_recover
+static I2C_HandleTypeDef *queue_fault_i2c; // Bus du transfert en erreur, libéré par PCA9685_watchdog
+static volatile uint8_t queue_reading = 0; // Lecture DMA en cours (PCA9685_scrub) : file arrêtée
+static volatile uint8_t queue_read_done = 0; // Lecture terminée, comparée par le prochain PCA9685_scrub
+static I2C_HandleTypeDef *queue_read_i2c;  // Bus de la lecture en cours
+static uint32_t queue_tick;              // HAL_GetTick() au début du transfert en cours
+#if PCA_MEASURE
+static uint32_t queue_start;             // DWT->CYCCNT au début du transfert en cours
+#endif
+
+
+/*!
+ *  @brief Lancer le prochain transfert de la file s'il n'y en a pas en cours
+ *  @note A appeler avec les interruptions désactivées ou depuis un callback I2C
+ */
+static void PCA9685_queue_next(void) {
+	while (!queue_busy && !queue_fault && !queue_reading && queue_tail != queue_head) {
+		PCA9685_Transfer *t = &queue[queue_tail];
+		queue_tick = HAL_GetTick();
+
+#if PCA_MEASURE
+		queue_start = DWT->CYCCNT;
+#endif
+		if (HAL_I2C_Master_Transmit_DMA(t->i2c, t->addr, t->data, t->len) == HAL_OK) {
+			queue_busy = 1;
+			return;
+		}
+
+		// Le périphérique refuse le transfert, on l'abandonne pour ne pas bloquer la file
+		PCA9685_errors.dropped++;
+		queue_tail = (queue_tail + 1) % PCA_QUEUE_SIZE;
+		PCA9685_transfer_done(t->owner, 1);
+	}
+}
+
+
+/*!
+ *  @brief Libérer le transfert en cours et lancer le suivant
+ *  @param error Le code d'erreur HAL du transfert (0 si réussi)
+ *
+ *  Après une erreur de bus, la file reste arrêtée jusqu'à PCA9685_recover
+ */
+static void PCA9685_queue_done(uint32_t error) {
+	if (!queue_busy)
+		return;
+
+	if (error) {
+		PCA9685_errors.dropped++;
+		if (PCA9685_count_error(error)) {
+			queue_fault = 1;
+			queue_fault_i2c = queue[queue_tail].i2c;
+		}
+	}
+#if PCA_MEASURE
+	else
+		PCA9685_measure_done(queue_start, queue[queue_tail].data, queue[queue_tail].len);
+#endif
+
+	PCA9685_Handle *owner = queue[queue_tail].owner;
+	queue_tail = (queue_tail + 1) % PCA_QUEUE_SIZE;
+	queue_busy = 0;
+
+	PCA9685_transfer_done(owner, error);
+	PCA9685_queue_next();
+}
+
+
+/*!
+ *  @brief Terminer la lecture en cours et relancer la file
+ *  @param error Le code d'erreur HAL de la lecture (0 si réussie)
+ *
+ *  La comparaison avec le cache (et l'éventuelle réécriture) est laissée à
+ *  PCA9685_scrub, dans la boucle principale
+ */
+static void PCA9685_read_done(uint32_t error) {
+	if (!queue_reading)
+		return;
+
+	if (error && PCA9685_count_error(error)) {
+		queue_fault = 1;
+		queue_fault_i2c = queue_read_i2c;
+	}
+
+	queue_read_done = !error;
+	queue_reading = 0;
+	PCA9685_queue_next();
+}
+
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	PCA9685_queue_done(0);
+}
+
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	PCA9685_read_done(0);
+}
+
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+	uint32_t error = hi2c->ErrorCode ? hi2c->ErrorCode : HAL_I2C_ERROR_BERR;
+
+	if (queue_reading)
+		PCA9685_read_done(error);
+	else
+		PCA9685_queue_done(error);
+}
+#endif
+
+
+/*!
+ *  @brief Attendre environ une demi-période d'horloge I2C à 100kHz (5µs)
+ */
+static void PCA9685_bus_delay(void) {
+	for (volatile uint32_t i = SystemCoreClock / 800000 + 1; i > 0; i--);
+}
+
+
+/*!
+ *  @brief Savoir si une carte maintient SDA à l'état bas
+ *  @return 1 si SDA est à l'état bas, 0 sinon
+ *
+ *  Le registre IDR reflète l'état de la broche même en mode alternatif
+ */
+static int PCA9685_sda_stuck(void) {
+	return HAL_GPIO_ReadPin(PCA_I2C_GPIO, PCA_SDA_PIN) == GPIO_PIN_RESET;
+}
+
+
+/*!
+ *  @brief Libérer le bus en générant jusqu'à 9 coups d'horloge puis un STOP
+ *  @note Les broches doivent être libérées par l'I2C (HAL_I2C_DeInit)
+ *
+ *  Une carte interrompue au milieu d'un octet garde SDA à l'état bas : les coups
+ *  d'horloge lui font terminer l'octet, le STOP remet sa logique I2C à zéro
+ */
+static void PCA9685_bus_clear(void) {
+	GPIO_InitTypeDef gpio = {0};
+	gpio.Pin = PCA_SCL_PIN | PCA_SDA_PIN;
+	gpio.Mode = GPIO_MODE_OUTPUT_OD;
+	gpio.Pull = GPIO_NOPULL;
+	gpio.Speed = GPIO_SPEED_FREQ_LOW;
+
+	HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SCL_PIN | PCA_SDA_PIN, GPIO_PIN_SET);
+	HAL_GPIO_Init(PCA_I2C_GPIO, &gpio);
+	PCA9685_bus_delay();
+
+	for (uint8_t i = 0; i < 9 && PCA9685_sda_stuck(); i++) {
+		HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SCL_PIN, GPIO_PIN_RESET);
+		PCA9685_bus_delay();
+		HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SCL_PIN, GPIO_PIN_SET);
+		PCA9685_bus_delay();
+	}
+
+	// STOP : SDA passe à l'état haut pendant que SCL est à l'état haut
+	HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SCL_PIN, GPIO_PIN_RESET);
+	PCA9685_bus_delay();
+	HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SDA_PIN, GPIO_PIN_RESET);
+	PCA9685_bus_delay();
+	HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SCL_PIN, GPIO_PIN_SET);
+	PCA9685_bus_delay();
+	HAL_GPIO_WritePin(PCA_I2C_GPIO, PCA_SDA_PIN, GPIO_PIN_SET);
+	PCA9685_bus_delay();
+}
+
+
+/*!
+ *  @brief Ajouter une carte à la liste des cartes suivies par PCA9685_poll, PCA9685_scrub
+ *  et PCA9685_recover
+ *  @param pca La carte
+ *  @return Un code d'erreur (PCA_ERR_BOARDS si la liste est pleine)
+ */
+static int PCA9685_register(PCA9685_Handle *pca) {
+	for (uint8_t i = 0; i < handle_count; i++)
+		if (handles[i] == pca)
+			return 0;
+
+	if (handle_count >= PCA_MAX_BOARDS)
+		return PCA_ERR_BOARDS;
+
+	handles[handle_count++] = pca;
+	return 0;
+}
+
+
+/*!
+ *  @brief Valeur de MODE1 à écrire sans changer l'état de veille de la carte
+ *  @param pca La carte
+ */
+static uint8_t PCA9685_mode1(PCA9685_Handle *pca) {
+	return pca->state == PCA_STATE_SLEEP ? pca->mode1 | PCA_MODE1_SLEEP : pca->mode1;
+}
+
+
+/*!
+ *  @brief Libérer le bus et réinitialiser l'I2C, puis réécrire l'état des cartes
  *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
- *  @param reg L'adresse du registre sur lequel écrire
- *  @param val La valeur à écrire sur le registre
- *  @return Status HAL
+ *  @return Un code d'erreur
+ *
+ *  Le transfert en cours est abandonné. MODE1 et tous les channels des cartes
+ *  initialisées sur ce bus sont renvoyés depuis leur cache
  */
-int PCA9685_write(I2C_HandleTypeDef *i2c, uint8_t reg, uint8_t val) {
-	uint8_t data[2] = {reg, val};
-	return HAL_I2C_Master_Transmit(i2c, PCA_I2C_ADDR, data, 2, PCA_I2C_TIMEOUT);
+int PCA9685_recover(I2C_HandleTypeDef *i2c) {
+	recovering = 1;
+
+#if PCA_USE_DMA
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (queue_busy) {
+		PCA9685_errors.dropped++;
+		PCA9685_transfer_done(queue[queue_tail].owner, 1);
+		queue_tail = (queue_tail + 1) % PCA_QUEUE_SIZE;
+		queue_busy = 0;
+	}
+
+	// La lecture en cours est abandonnée, PCA9685_scrub passe à l'étape suivante
+	queue_reading = 0;
+	queue_read_done = 0;
+
+	// La file reste arrêtée tant que le bus n'est pas libéré
+	queue_fault = 1;
+	__set_PRIMASK(primask);
+#endif
+
+	HAL_I2C_DeInit(i2c);
+	PCA9685_bus_clear();
+
+	int status = HAL_I2C_Init(i2c) == HAL_OK ? 0 : PCA_ERR_RECOVER;
+	PCA9685_errors.recoveries++;
+
+#if PCA_USE_DMA
+	primask = __get_PRIMASK();
+	__disable_irq();
+	queue_fault = 0;
+	queue_fault_i2c = NULL;
+	PCA9685_queue_next();
+	__set_PRIMASK(primask);
+#endif
+
+	// Les cartes ont pu manquer des écritures : on renvoie tout leur état
+	for (uint8_t i = 0; status == 0 && i < handle_count; i++) {
+		PCA9685_Handle *pca = handles[i];
+		if (pca->i2c != i2c)
+			continue;
+
+		PCA9685_write(pca, PCA_REG_MODE1, PCA9685_mode1(pca));
+		pca->dirty = PCA_DIRTY_ALL;
+		PCA9685_flush(pca);
+	}
+
+	recovering = 0;
+	return status;
 }
 
 
 /*!
- *  @brief Ecrire dans des registres successifs
+ *  @brief Libérer le bus si le transfert en cours a échoué ou dure trop longtemps
+ *  @param i2c Le bus à libérer si celui du transfert n'est pas connu (NULL sinon)
+ *
+ *  Borne le temps pendant lequel une commande peut rester bloquée à
+ *  PCA_I2C_TIMEOUT plus la durée de PCA9685_recover. Le bus libéré est celui du
+ *  transfert en erreur, enregistré avec l'erreur : la case de la file a déjà été
+ *  libérée à ce moment
+ */
+static void PCA9685_watchdog(I2C_HandleTypeDef *i2c) {
+#if PCA_USE_DMA
+	// La libération attend HAL_GetTick : jamais en interruption, la boucle principale s'en charge
+	if (recovering || __get_IPSR() != 0)
+		return;
+
+	if (queue_fault) {
+		I2C_HandleTypeDef *bus = queue_fault_i2c ? queue_fault_i2c : i2c;
+		if (bus != NULL)
+			PCA9685_recover(bus);
+		return;
+	}
+
+	if ((queue_busy || queue_reading) && HAL_GetTick() - queue_tick > PCA_I2C_TIMEOUT) {
+		PCA9685_errors.timeout++;
+		PCA9685_recover(queue_reading ? queue_read_i2c : queue[queue_tail].i2c);
+	}
+#endif
+}
+
+
+/*!
+ *  @brief Vérifier l'état du bus et le libérer si besoin (à appeler dans la boucle principale)
+ *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @return 1 si le bus a été libéré, 0 sinon
+ *
+ *  Détecte les transferts en erreur ou trop longs et SDA maintenu à l'état bas
+ *  alors qu'aucun transfert n'est en cours, sur deux appels consécutifs
+ */
+int PCA9685_check_bus(I2C_HandleTypeDef *i2c) {
+	static uint8_t stuck_samples = 0;
+	uint32_t recoveries = PCA9685_errors.recoveries;
+	PCA9685_watchdog(i2c);
+
+	// Un transfert lancé depuis une interruption entre les tests ferait croire à SDA bloqué
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	int stuck = PCA9685_queue_idle() && HAL_I2C_GetState(i2c) == HAL_I2C_STATE_READY && PCA9685_sda_stuck();
+	__set_PRIMASK(primask);
+
+	// Deux appels consécutifs avec SDA à l'état bas pour ignorer un STOP en cours
+	stuck_samples = stuck ? stuck_samples + 1 : 0;
+	if (stuck_samples >= 2) {
+		stuck_samples = 0;
+		PCA9685_errors.stuck++;
+		PCA9685_recover(i2c);
+	}
+
+	return PCA9685_errors.recoveries != recoveries;
+}
+
+
+/*!
+ *  @brief Envoyer un octet de registre suivi de ses données à une adresse I2C
+ *  @param owner La carte à prévenir à la fin du transfert (NULL sinon)
  *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @param addr L'adresse I2C (d'une carte, All Call ou sous-adresse)
  *  @param reg L'adresse du premier registre sur lequel écrire
  *  @param data Les valeurs (octets) à écrire
  *  @param data_len Le nombre d'octets à écrire
  *  @return Status HAL ou code d'erreur
+ *
+ *  Avec PCA_USE_DMA, le transfert est seulement ajouté à la file : la fonction
+ *  retourne immédiatement et l'envoi se fait en DMA dans l'ordre des appels
  */
-int PCA9685_write_data(I2C_HandleTypeDef *i2c, uint8_t reg, uint8_t *data, uint8_t data_len) {
-	if (data_len < 0) return PCA_ERR_DATA_TOO_SMALL;
-	if( data_len > 4) return PCA_ERR_DATA_TOO_BIG;
+static int PCA9685_transmit_to(PCA9685_Handle *owner, I2C_HandleTypeDef *i2c, uint16_t addr, uint8_t reg, const uint8_t *data, uint8_t data_len) {
+#if PCA_USE_DMA
+	PCA9685_watchdog(i2c);
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-    //int status;
+	uint8_t next = (queue_head + 1) % PCA_QUEUE_SIZE;
+	if (next == queue_tail) {
+		__set_PRIMASK(primask);
+		return PCA_ERR_QUEUE_FULL;
+	}
 
-	//for (uint8_t i=0; i < data_len; i++)
-	//	if ((status = PCA9685_write(i2c, reg+i, data[i])) != HAL_OK)
-	//		return status;
+	PCA9685_Transfer *t = &queue[queue_head];
+	t->owner = owner;
+	t->i2c = i2c;
+	t->addr = addr;
+	t->len = data_len + 1;
+	t->data[0] = reg;
+	memcpy(&t->data[1], data, data_len);
 
+	if (owner)
+		owner->pending++;
+
+	queue_head = next;
+	PCA9685_queue_next();
+
+	__set_PRIMASK(primask);
+	return HAL_OK;
+#else
 	uint8_t i2c_data[data_len+1];
 	i2c_data[0] = reg;
 	memcpy(&i2c_data[1], data, data_len);
 
-	return HAL_I2C_Master_Transmit(i2c, PCA_I2C_ADDR, i2c_data, data_len+1, PCA_I2C_TIMEOUT);
+#if PCA_MEASURE
+	uint32_t start = DWT->CYCCNT;
+#endif
+	if (owner)
+		owner->pending++;
+
+	int status = HAL_I2C_Master_Transmit(i2c, addr, i2c_data, data_len+1, PCA_I2C_TIMEOUT);
+	PCA9685_transfer_done(owner, status != HAL_OK);
+
+	if (status != HAL_OK) {
+		// Bus bloqué : on le libère tout de suite, la commande est perdue mais pas les suivantes
+		if (PCA9685_count_error(status == HAL_TIMEOUT ? HAL_I2C_ERROR_TIMEOUT : i2c->ErrorCode) && !recovering && __get_IPSR() == 0)
+			PCA9685_recover(i2c);
+		return status;
+	}
+
+#if PCA_MEASURE
+	PCA9685_measure_done(start, i2c_data, data_len+1);
+#endif
+	return status;
+#endif
 }
 
 
 /*!
- *  @brief Initialisation de la carte
- *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
- *  @return Si il y a eu une erreur pour l'écriture
+ *  @brief Envoyer un octet de registre suivi de ses données à une carte
+ *  @param pca La carte à contrôler
+ *  @param reg L'adresse du premier registre sur lequel écrire
+ *  @param data Les valeurs (octets) à écrire
+ *  @param data_len Le nombre d'octets à écrire
+ *  @return Status HAL ou code d'erreur
  */
-int PCA9685_init(I2C_HandleTypeDef *i2c) {
-	// On active le sleep mode pour modifier le diviseur (cf. pages 13 et 14)
-	// et l'auto-increment pour modifier plusieurs registres en une écriture
-	if (PCA9685_write(i2c, PCA_REG_MODE1, 0b00110000) != HAL_OK)
-		return PCA_ERR_INIT_SLEEP;
+static int PCA9685_transmit(PCA9685_Handle *pca, uint8_t reg, const uint8_t *data, uint8_t data_len) {
+	return PCA9685_transmit_to(NULL, pca->i2c, pca->addr, reg, data, data_len);
+}
 
-	// Cf. page 16
-	if (PCA9685_write(i2c, PCA_REG_MODE2, 0b00000000) != HAL_OK)
-		return PCA_ERR_INIT_MODE2;
 
-	// On désactive tous les channels (cf. page 25 registre FDh)
-    uint8_t data[4] = {0x00, 0x00, 0x00, 0x10};
-    if (PCA9685_write_data(i2c, PCA_REG_ALL_ON_L, data, 4) != HAL_OK)
-        return PCA_ERR_INIT_RESET;
+/*!
+ *  @brief Nombre de transferts qui peuvent encore être ajoutés à la file
+ *  @return Le nombre de cases libres (PCA_QUEUE_SIZE sans DMA, les écritures sont bloquantes)
+ */
+static uint8_t PCA9685_queue_free(void) {
+#if PCA_USE_DMA
+	return (queue_tail + PCA_QUEUE_SIZE - queue_head - 1) % PCA_QUEUE_SIZE;
+#else
+	return PCA_QUEUE_SIZE;
+#endif
+}
 
-	// Calcul du diviseur pour avoir la fréquence voulue (cf. page 25)
-	uint8_t prescaler_val = (uint8_t) roundf(25000000.0f / (4096 * PCA_PRESCALER_FREQ)) - 1;
-	if (PCA9685_write(i2c, PCA_REG_PRESCALER, prescaler_val) != HAL_OK)
-		return PCA_ERR_INIT_PRESCALER;
 
-	// On désactive le sleep mode pour pouvoir piloter les servos (cf. page 14)
-	if (PCA9685_write(i2c, PCA_REG_MODE1, 0b00100000) != HAL_OK)
-		return PCA_ERR_INIT_WAKEUP;
+/*!
+ *  @brief Savoir si tous les transferts en attente ont été envoyés
+ *  @return 1 si la file est vide, 0 sinon
+ */
+int PCA9685_queue_idle(void) {
+#if PCA_USE_DMA
+	return !queue_busy && !queue_reading && !queue_fault && queue_tail == queue_head;
+#else
+	return 1;
+#endif
+}
+
+
+/*!
+ *  @brief Attendre que tous les transferts en attente aient été envoyés
+ *  @param timeout La durée maximale d'attente (ms)
+ *  @return Un code d'erreur
+ */
+int PCA9685_wait(uint32_t timeout) {
+	uint32_t start = HAL_GetTick();
+
+	while (!PCA9685_queue_idle()) {
+		if (HAL_GetTick() - start > timeout)
+			return PCA_ERR_QUEUE_TIMEOUT;
+
+		PCA9685_watchdog(NULL);
+	}
 
-    // On attend au moins 500us pour que l'oscillateur se stabilise
-	HAL_Delay(1);
 	return 0;
 }
 
 
 /*!
- *  @brief Désactiver un channel
- *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
- *  @param channel Le channel à désactiver (0 à 15)
- *  @return Un code d'erreur
+ *  @brief Ecrire dans un seul registre (cf. page 32)
+ *  @param pca La carte à contrôler
+ *  @param reg L'adresse du registre sur lequel écrire
+ *  @param val La valeur à écrire sur le registre
+ *  @return Status HAL ou code d'erreur
  */
-int PCA9685_turn_off(I2C_HandleTypeDef *i2c, uint8_t channel) {
-    if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
-    if (channel > 16) return PCA_ERR_CHAN_TOO_BIG;
+int PCA9685_write(PCA9685_Handle *pca, uint8_t reg, uint8_t val) {
+	return PCA9685_transmit(pca, reg, &val, 1);
+}
+
+
+/*!
+ *  @brief Ecrire dans des registres successifs
+ *  @param pca La carte à contrôler
+ *  @param reg L'adresse du premier registre sur lequel écrire
+ *  @param data Les valeurs (octets) à écrire
+ *  @param data_len Le nombre d'octets à écrire (PCA_MAX_DATA_LEN au maximum)
+ *  @return Status HAL ou code d'erreur
+ */
+int PCA9685_write_data(PCA9685_Handle *pca, uint8_t reg, uint8_t *data, uint8_t data_len) {
+	if (data_len < 0) return PCA_ERR_DATA_TOO_SMALL;
+	if (data_len > PCA_MAX_DATA_LEN) return PCA_ERR_DATA_TOO_BIG;
 
-    uint8_t data[2] = {0x00, 0x10};
-    return PCA9685_write_data(i2c, PCA_REG_CHAN0_OFF_L + channel*4, data, 2);
+	return PCA9685_transmit(pca, reg, data, data_len);
 }
 
 
 /*!
- *  @brief Directement définir la valeur du PWM
- *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
- *  @param channel Le servomoteur à contrôler (0 à 15)
- *  @param points Le nombre de points ON (0 à PCA_PWM_RANGE)
- *  @return Un code d'erreur
+ *  @brief Masque des octets first à first + len - 1 du cache
+ *  @param first Le premier octet
+ *  @param len Le nombre d'octets (1 à PCA_MAX_DATA_LEN - first)
  */
-int PCA9685_set_pwm(I2C_HandleTypeDef *i2c, uint8_t channel, float points) {
-	if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
-	if (channel > 16) return PCA_ERR_CHAN_TOO_BIG;
+static inline uint64_t PCA9685_byte_mask(uint8_t first, uint8_t len) {
+	return (len >= 64 ? ~0ULL : (1ULL << len) - 1) << first;
+}
+
+
+/*!
+ *  @brief Modifier les registres d'un channel dans le cache
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à modifier (0 à 15)
+ *  @param on Le compte de passage à l'état haut (ON_L/ON_H)
+ *  @param off Le compte de passage à l'état bas (OFF_L/OFF_H)
+ *
+ *  Seuls les octets dont la valeur change sont marqués à renvoyer
+ */
+static void PCA9685_cache_set(PCA9685_Handle *pca, uint8_t channel, uint16_t on, uint16_t off) {
+	uint8_t data[PCA_CHANNEL_SIZE] = {on & 0xff, (on >> 8) & 0xff, off & 0xff, (off >> 8) & 0xff};
+	uint8_t first = channel*PCA_CHANNEL_SIZE;
+
+	// Le cache peut être envoyé depuis une interruption de l'application (PCA9685_flush)
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-	uint16_t on_count = map(points, 0, PCA_PWM_RANGE, PCA_PWM_MIN, PCA_PWM_MAX);
+	for (uint8_t i = 0; i < PCA_CHANNEL_SIZE; i++) {
+		if (pca->shadow[first + i] == data[i])
+			continue;
 
-	if (on_count > PCA_PWM_MAX) return PCA_ERR_COUNT_TOO_BIG;
-	if (on_count < PCA_PWM_MIN) return PCA_ERR_COUNT_TOO_SMALL;
+		pca->shadow[first + i] = data[i];
+		pca->dirty |= 1ULL << (first + i);
+	}
 
-	uint8_t data[2] = {on_count & 0xff, (on_count >> 8) & 0xff};
-	return PCA9685_write_data(i2c, PCA_REG_CHAN0_OFF_L + channel*4, data, 2);
+	__set_PRIMASK(primask);
 }
 
 
 /*!
- *  @brief Définir un cycle de service
- *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
- *  @param channel Le servomoteur à contrôler (0 à 15)
- *  @param duty_cycle La valeur du cycle (0 à 1)
+ *  @brief Lire les comptes d'un channel dans le cache
+ *  @param pca La carte
+ *  @param channel Le channel à lire (0 à 15)
+ *  @param on Le compte de passage à l'état haut, avec le bit FULL_ON (0x1000)
+ *  @param off Le compte de passage à l'état bas, avec le bit FULL_OFF (0x1000)
+ */
+static void PCA9685_cache_get(const PCA9685_Handle *pca, uint8_t channel, uint16_t *on, uint16_t *off) {
+	const uint8_t *chan = &pca->shadow[channel*PCA_CHANNEL_SIZE];
+
+	*on = chan[0] | (chan[1] << 8);
+	*off = chan[2] | (chan[3] << 8);
+}
+
+
+/*!
+ *  @brief Modifier la durée d'impulsion d'un channel dans le cache
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à modifier (0 à 15)
+ *  @param width La durée à l'état haut (comptes, 0 à 4095)
+ *
+ *  Avec le décalage de phase (pca->stagger), le channel passe à l'état haut au
+ *  compte channel*PCA_STAGGER_STEP et OFF = ON + width revient à 0 après 4095
+ */
+static void PCA9685_cache_set_width(PCA9685_Handle *pca, uint8_t channel, uint16_t width) {
+	uint16_t on = pca->stagger ? channel*PCA_STAGGER_STEP : 0;
+	PCA9685_cache_set(pca, channel, on, (on + width) & 0xfff);
+}
+
+
+/*!
+ *  @brief Modifier les registres de tous les channels dans le cache
+ *  @param pca La carte à contrôler
+ *  @param on Le compte de passage à l'état haut (ON_L/ON_H)
+ *  @param off Le compte de passage à l'état bas (OFF_L/OFF_H)
+ *
+ *  A appeler après une écriture sur les registres ALL_LED : la carte contient
+ *  alors ces valeurs, il n'y a plus rien à renvoyer
+ */
+static void PCA9685_cache_set_all(PCA9685_Handle *pca, uint16_t on, uint16_t off) {
+	uint8_t data[PCA_CHANNEL_SIZE] = {on & 0xff, (on >> 8) & 0xff, off & 0xff, (off >> 8) & 0xff};
+
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++)
+		memcpy(&pca->shadow[i*PCA_CHANNEL_SIZE], data, PCA_CHANNEL_SIZE);
+	pca->dirty = 0;
+}
+
+
+/*!
+ *  @brief Envoyer les channels modifiés si PCA_AUTO_FLUSH est activé
+ *  @param pca La carte à contrôler
  *  @return Un code d'erreur
  */
-int PCA9685_set_cycle(I2C_HandleTypeDef *i2c, uint8_t channel, float duty_cycle) {
-	if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
-	if (channel > 16) return PCA_ERR_CHAN_TOO_BIG;
+static int PCA9685_auto_flush(PCA9685_Handle *pca) {
+#if PCA_AUTO_FLUSH
+	return PCA9685_flush(pca);
+#else
+	return 0;
+#endif
+}
 
-	if (duty_cycle < 0) return PCA_ERR_CYCLE_TOO_SMALL;
-	if (duty_cycle > 1) return PCA_ERR_CYCLE_TOO_BIG;
 
-	uint16_t points = (uint16_t) (duty_cycle*PCA_PWM_RANGE);
-	return PCA9685_set_pwm(i2c, channel, points);
+/*!
+ *  @brief Nombre de points d'un channel (écart entre ses comptes min et max)
+ *  @param scale La conversion du channel
+ *  @return Le nombre de points
+ */
+static inline uint16_t PCA9685_scale_span(const PCA9685_Scale *scale) {
+	return scale->range < 0 ? -scale->range : scale->range;
+}
+
+
+/*!
+ *  @brief Convertir un nombre de points en compte (sens inversé si range < 0)
+ *  @param scale La conversion du channel
+ *  @param points Le nombre de points ON (0 à PCA9685_scale_span)
+ *  @return Le compte de passage à l'état bas
+ */
+static inline uint16_t PCA9685_points_to_count(const PCA9685_Scale *scale, uint16_t points) {
+	return scale->range < 0 ? scale->offset - points : scale->offset + points;
+}
+
+
+/*!
+ *  @brief Calculer le diviseur de l'oscillateur pour une fréquence PWM (cf. page 25)
+ *  @param osc_hz La fréquence de l'oscillateur (interne ou EXTCLK)
+ *  @param hz La fréquence PWM voulue
+ *  @return La valeur du registre PRE_SCALE, -1 si la fréquence n'est pas atteignable
+ */
+static int PCA9685_prescaler(uint32_t osc_hz, uint16_t hz) {
+	if (hz == 0) return -1;
+
+	// round(osc / (4096 * hz)) - 1, le registre est limité à 3..255
+	int32_t prescaler = (int32_t) ((osc_hz + 2048UL*hz) / (4096UL*hz)) - 1;
+	if (prescaler < PCA_PRESCALER_MIN || prescaler > 255)
+		return -1;
+
+	return prescaler;
+}
+
+
+/*!
+ *  @brief Recalculer la conversion d'un channel à partir de sa calibration
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à recalculer (0 à 15)
+ *
+ *  Les durées sont converties en comptes une seule fois ici : le chemin de
+ *  commande n'a plus qu'à lire pca->scale[channel]
+ */
+static void PCA9685_calib_apply(PCA9685_Handle *pca, uint8_t channel) {
+	const PCA9685_Calib *calib = &pca->calib[channel];
+	PCA9685_Scale *scale = &pca->scale[channel];
+
+	uint16_t min = (uint16_t) ((uint32_t) calib->min_us * 4096 / pca->cycle_us);
+	uint16_t max = (uint16_t) ((uint32_t) calib->max_us * 4096 / pca->cycle_us);
+
+	scale->offset = calib->invert ? max : min;
+	scale->range = calib->invert ? min - max : max - min;
+	scale->neutral = (uint16_t) ((uint32_t) calib->neutral_us * 4096 / pca->cycle_us);
+}
+
+
+/*!
+ *  @brief Modifier la calibration d'un channel (en RAM, cf. PCA9685_calib_save)
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à calibrer (0 à 15)
+ *  @param calib Les durées d'impulsion (µs) et le sens du channel
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_calib(PCA9685_Handle *pca, uint8_t channel, const PCA9685_Calib *calib) {
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+	if (calib->min_us >= calib->max_us) return PCA_ERR_CALIB_INVALID;
+	if (calib->max_us >= pca->cycle_us) return PCA_ERR_CALIB_INVALID;
+	if (calib->neutral_us < calib->min_us || calib->neutral_us > calib->max_us) return PCA_ERR_CALIB_INVALID;
+
+	pca->calib[channel] = *calib;
+	PCA9685_calib_apply(pca, channel);
+	return 0;
+}
+
+
+/*!
+ *  @brief Charger la calibration d'une carte depuis la page de flash réservée
+ *  @param pca La carte à contrôler
+ *  @param slot L'emplacement de la carte dans la page (0 à PCA_CALIB_SLOTS - 1)
+ *  @return Un code d'erreur (la calibration en RAM n'est pas modifiée)
+ */
+int PCA9685_calib_load(PCA9685_Handle *pca, uint8_t slot) {
+	if (slot >= PCA_CALIB_SLOTS) return PCA_ERR_CALIB_SLOT;
+
+	const PCA9685_CalibSlot *stored = &((const PCA9685_CalibSlot *) PCA_CALIB_ADDR)[slot];
+	if (stored->magic != PCA_CALIB_MAGIC) return PCA_ERR_CALIB_EMPTY;
+
+	memcpy(pca->calib, stored->calib, sizeof(pca->calib));
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++)
+		PCA9685_calib_apply(pca, i);
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Enregistrer la calibration d'une carte dans la page de flash réservée
+ *  @param pca La carte à contrôler
+ *  @param slot L'emplacement de la carte dans la page (0 à PCA_CALIB_SLOTS - 1)
+ *  @return Un code d'erreur
+ *
+ *  La page est effacée puis réécrite en conservant les autres emplacements.
+ *  Le CPU est bloqué pendant l'effacement (environ 22ms, cf. RM0394)
+ */
+int PCA9685_calib_save(PCA9685_Handle *pca, uint8_t slot) {
+	if (slot >= PCA_CALIB_SLOTS) return PCA_ERR_CALIB_SLOT;
+
+	// Tampon de uint64_t : la page est programmée par double mot aligné sur 8 octets
+	static uint64_t buffer[(PCA_CALIB_SLOTS*sizeof(PCA9685_CalibSlot) + 7) / 8];
+	PCA9685_CalibSlot *page = (PCA9685_CalibSlot *) buffer;
+	memcpy(page, (const void *) PCA_CALIB_ADDR, PCA_CALIB_SLOTS*sizeof(PCA9685_CalibSlot));
+
+	page[slot].magic = PCA_CALIB_MAGIC;
+	page[slot].reserved = 0xffffffff;
+	memcpy(page[slot].calib, pca->calib, sizeof(pca->calib));
+
+	FLASH_EraseInitTypeDef erase = {
+		.TypeErase = FLASH_TYPEERASE_PAGES,
+		.Banks = FLASH_BANK_1,
+		.Page = (PCA_CALIB_ADDR - FLASH_BASE) / FLASH_PAGE_SIZE,
+		.NbPages = 1
+	};
+	uint32_t page_error;
+	int status = 0;
+
+	HAL_FLASH_Unlock();
+
+	if (HAL_FLASHEx_Erase(&erase, &page_error) != HAL_OK)
+		status = PCA_ERR_CALIB_FLASH;
+
+	// Programmation par double mot (64 bits)
+	for (uint32_t i = 0; status == 0 && i < sizeof(buffer) / 8; i++)
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, PCA_CALIB_ADDR + i*8, buffer[i]) != HAL_OK)
+			status = PCA_ERR_CALIB_FLASH;
+
+	HAL_FLASH_Lock();
+	return status;
+}
+
+
+/*!
+ *  @brief Placer un channel à sa position neutre (calibration)
+ *  @param pca La carte à contrôler
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_neutral(PCA9685_Handle *pca, uint8_t channel) {
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+	PCA9685_cache_set_width(pca, channel, pca->scale[channel].neutral);
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Lancer l'initialisation de la carte sans attendre
+ *  @param pca La carte à initialiser (structure remplie par la fonction)
+ *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @param addr L'adresse I2C de la carte (PCA_I2C_ADDR + A5..A0 décalés d'un bit)
+ *  @param on_ready Fonction appelée à la fin de l'initialisation (en interruption en cas d'erreur), ou NULL
+ *  @return Si il y a eu une erreur pour l'ajout de la première écriture dans la file
+ *
+ *  Les écritures partent en DMA, chacune est ajoutée à la file à la fin de la
+ *  précédente (une case par carte). Quand elles sont terminées, la carte passe en
+ *  PCA_STATE_SETTLE, puis PCA9685_poll la passe en PCA_STATE_READY une fois
+ *  l'oscillateur stabilisé : plusieurs cartes peuvent démarrer en même temps
+ *
+ *  Seules les PCA_CALIB_SLOTS premières adresses ont un emplacement de calibration
+ *  en flash : les cartes suivantes (A5..A0 >= 15) utilisent la calibration de pca9685.h
+ */
+int PCA9685_init_async(PCA9685_Handle *pca, I2C_HandleTypeDef *i2c, uint16_t addr, PCA9685_Callback on_ready) {
+	pca->i2c = i2c;
+	pca->addr = addr;
+	pca->on_ready = on_ready;
+
+	// Une carte absente de la liste ne passerait jamais en PCA_STATE_READY
+	if (PCA9685_register(pca) != 0) {
+		pca->init_error = PCA_ERR_BOARDS;
+		pca->state = PCA_STATE_ERROR;
+		return PCA_ERR_BOARDS;
+	}
+#if PCA_MEASURE
+	PCA9685_measure_init();
+#endif
+	pca->cycle_us = (uint16_t) (PCA_PWM_CYCLE_TIME*1000);
+	pca->osc_hz = PCA_EXTCLK_FREQ ? PCA_EXTCLK_FREQ : PCA_OSC_FREQ;
+	pca->stagger = PCA_STAGGER;
+
+	// Calibration enregistrée en flash pour cette adresse, sinon celle de pca9685.h
+	if (PCA9685_calib_load(pca, (addr - PCA_I2C_ADDR) >> 1) != 0) {
+		for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++) {
+			pca->calib[i].min_us = (uint16_t) (PCA_PWM_MIN_TIME*1000);
+			pca->calib[i].max_us = (uint16_t) (PCA_PWM_MAX_TIME*1000);
+			pca->calib[i].neutral_us = (pca->calib[i].min_us + pca->calib[i].max_us) / 2;
+			pca->calib[i].invert = 0;
+			PCA9685_calib_apply(pca, i);
+		}
+	}
+	pca->mode1 = PCA_MODE1_AI | PCA_MODE1_ALLCALL;
+#if PCA_EXTCLK_FREQ
+	pca->mode1 |= PCA_MODE1_EXTCLK;
+#endif
+
+	// Calcul du diviseur pour avoir la fréquence voulue (cf. page 25)
+	pca->prescaler = (uint8_t) PCA9685_prescaler(pca->osc_hz, (uint16_t) (1000 / PCA_PWM_CYCLE_TIME));
+
+	pca->pending = 0;
+	pca->init_error = 0;
+	pca->init_step = 0;
+	pca->state = PCA_STATE_INIT;
+
+	// Le cache correspond aux registres de la carte après la séquence (ON = 0, FULL_OFF)
+	PCA9685_cache_set_all(pca, 0x0000, 0x1000);
+
+	int status = PCA9685_init_next(pca);
+	if (status != 0) {
+		pca->init_error = status;
+		pca->state = PCA_STATE_ERROR;
+	}
+
+	return pca->state == PCA_STATE_ERROR ? pca->init_error : 0;
+}
+
+
+/*!
+ *  @brief Mettre dans la file l'écriture d'initialisation suivante de la carte
+ *  @param pca La carte en cours d'initialisation
+ *  @return Le code d'erreur de l'étape si l'écriture n'a pas pu être ajoutée
+ *
+ *  Appelée par PCA9685_init_async pour la première étape, puis par PCA9685_transfer_done
+ *  à la fin de chaque écriture : une seule case de la file est occupée par carte
+ */
+static int PCA9685_init_next(PCA9685_Handle *pca) {
+	uint8_t step = pca->init_step++;
+	uint8_t val;
+	int status;
+
+	switch (step) {
+	// On active le sleep mode pour modifier le diviseur (cf. pages 13 et 14),
+	// l'auto-increment pour modifier plusieurs registres en une écriture
+	// et l'adresse All Call pour les mises à jour groupées (cf. page 7)
+	case 0:
+		val = (pca->mode1 & ~PCA_MODE1_EXTCLK) | PCA_MODE1_SLEEP;
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_MODE1, &val, 1);
+		break;
+
+	// EXTCLK ne peut être activé qu'une fois en sleep mode, il reste actif jusqu'au reset (cf. page 14)
+	case 1:
+#if PCA_EXTCLK_FREQ
+		val = pca->mode1 | PCA_MODE1_SLEEP;
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_MODE1, &val, 1);
+		break;
+#else
+		return PCA9685_init_next(pca);
+#endif
+
+	// Cf. page 16
+	case 2:
+		val = 0b00000000;
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_MODE2, &val, 1);
+		break;
+
+	// On désactive tous les channels (cf. page 25 registre FDh)
+	case 3: {
+		const uint8_t data[4] = {0x00, 0x00, 0x00, 0x10};
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_ALL_ON_L, data, 4);
+		break;
+	}
+
+	case 4:
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_PRESCALER, &pca->prescaler, 1);
+		break;
+
+	// On désactive le sleep mode pour pouvoir piloter les servos (cf. page 14)
+	default:
+		status = PCA9685_transmit_to(pca, pca->i2c, pca->addr, PCA_REG_MODE1, &pca->mode1, 1);
+		break;
+	}
+
+	// Sans DMA, un échec a déjà été traité par PCA9685_transfer_done
+	if (status == HAL_OK || pca->state == PCA_STATE_ERROR)
+		return 0;
+
+	return PCA9685_init_code(step);
+}
+
+
+/*!
+ *  @brief Passer la carte en PCA_STATE_READY si son oscillateur est stabilisé
+ *  @param pca La carte
+ *
+ *  Il faut au moins 500us après la sortie du sleep mode (cf. page 14) :
+ *  attendre 2 ticks garantit au moins 1ms. Au réveil (PCA_STATE_WAKE), le bit
+ *  RESTART relance ensuite les 16 channels avec les valeurs gardées en veille
+ */
+static void PCA9685_settle(PCA9685_Handle *pca) {
+	uint8_t state = pca->state;
+	if (state != PCA_STATE_SETTLE && state != PCA_STATE_WAKE)
+		return;
+	if (HAL_GetTick() - pca->settle_tick < 2)
+		return;
+
+	pca->state = PCA_STATE_READY;
+	if (state == PCA_STATE_WAKE)
+		PCA9685_write(pca, PCA_REG_MODE1, pca->mode1 | PCA_MODE1_RESTART);
+
+	if (pca->on_ready)
+		pca->on_ready(pca, 0);
+}
+
+
+#if !PCA_AUTO_FLUSH
+/*!
+ *  @brief Compter le temps écoulé dans le cycle PWM d'une carte
+ *  @param pca La carte
+ *
+ *  La carte ne prend les nouvelles valeurs qu'à la fin de chaque cycle :
+ *  seule la dernière valeur de chaque channel est envoyée, le trafic reste borné à
+ *  16 channels par cycle quel que soit le nombre d'appels de l'application
+ */
+static void PCA9685_frame(PCA9685_Handle *pca) {
+	if (pca->state != PCA_STATE_READY)
+		return;
+
+	pca->frame_us += 1000;
+	if (pca->frame_us < pca->cycle_us)
+		return;
+
+	// Le reste est gardé : les cycles qui ne durent pas un nombre entier de ms ne dérivent pas
+	pca->frame_us -= pca->cycle_us;
+	pca->frame_due = 1;
+}
+#endif
+
+
+/*!
+ *  @brief Compter les cycles PWM des cartes si PCA_AUTO_FLUSH est à 0
+ *  @note A appeler toutes les millisecondes (SysTick_Handler)
+ *
+ *  Aucun transfert I2C en interruption : le cycle est seulement marqué à
+ *  envoyer, PCA9685_poll fait l'envoi
+ */
+void PCA9685_tick(void) {
+#if !PCA_AUTO_FLUSH
+	for (uint8_t i = 0; i < handle_count; i++)
+		PCA9685_frame(handles[i]);
+#endif
+}
+
+
+/*!
+ *  @brief Avancer les initialisations et les sorties de veille en cours, et envoyer
+ *  le cache des cartes dont le cycle PWM est écoulé si PCA_AUTO_FLUSH est à 0
+ *  @note A appeler dans la boucle principale
+ *
+ *  Sans PCA_USE_DMA, les écritures sont bloquantes et leur timeout dépend de
+ *  HAL_GetTick : elles ne doivent pas être faites depuis SysTick_Handler
+ */
+void PCA9685_poll(void) {
+	for (uint8_t i = 0; i < handle_count; i++) {
+		PCA9685_Handle *pca = handles[i];
+		PCA9685_settle(pca);
+#if !PCA_AUTO_FLUSH
+		if (!pca->frame_due)
+			continue;
+
+		pca->frame_due = 0;
+		if (pca->dirty)
+			PCA9685_flush(pca);
+#endif
+	}
+}
+
+
+/*!
+ *  @brief Savoir où en est l'initialisation (ou la mise en veille) d'une carte
+ *  @param pca La carte
+ *  @return Un état PCA_STATE_*
+ */
+int PCA9685_get_state(PCA9685_Handle *pca) {
+	return pca->state;
+}
+
+
+/*!
+ *  @brief Mettre la carte en veille (oscillateur arrêté, sorties éteintes)
+ *  @param pca La carte (initialisée)
+ *  @return Un code d'erreur
+ *
+ *  Les registres des 16 channels sont gardés : PCA9685_resume les relance
+ *  sans avoir à les renvoyer (cf. page 14)
+ */
+int PCA9685_sleep(PCA9685_Handle *pca) {
+	if (pca->state != PCA_STATE_READY) return PCA_ERR_STATE;
+
+	pca->state = PCA_STATE_SLEEP;
+	if (PCA9685_write(pca, PCA_REG_MODE1, pca->mode1 | PCA_MODE1_SLEEP) != HAL_OK)
+		return PCA_ERR_INIT_SLEEP;
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Sortir la carte de veille sans la réinitialiser
+ *  @param pca La carte (en veille)
+ *  @return Un code d'erreur
+ *
+ *  Retourne immédiatement : PCA9685_poll écrit RESTART une fois l'oscillateur
+ *  stabilisé puis passe la carte en PCA_STATE_READY (on_ready est appelée)
+ */
+int PCA9685_resume(PCA9685_Handle *pca) {
+	if (pca->state != PCA_STATE_SLEEP) return PCA_ERR_STATE;
+
+	// On désactive seulement le bit SLEEP, RESTART est écrit après la stabilisation
+	pca->settle_tick = HAL_GetTick();
+	pca->state = PCA_STATE_WAKE;
+	if (PCA9685_write(pca, PCA_REG_MODE1, pca->mode1) != HAL_OK)
+		return PCA_ERR_INIT_WAKEUP;
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Changer la fréquence PWM d'une carte sans la réinitialiser
+ *  @param pca La carte (initialisée)
+ *  @param hz La nouvelle fréquence (environ 24 à 1526Hz avec l'oscillateur interne)
+ *  @return Un code d'erreur
+ *
+ *  Séquence sleep, PRE_SCALE puis RESTART (cf. pages 14 et 25). Les comptes min/max
+ *  des channels sont recalculés et les channels gardent leur durée d'impulsion.
+ *  Retourne immédiatement, la carte repasse en PCA_STATE_READY par PCA9685_poll
+ */
+int PCA9685_set_frequency(PCA9685_Handle *pca, uint16_t hz) {
+	if (pca->state != PCA_STATE_READY) return PCA_ERR_STATE;
+
+	int prescaler = PCA9685_prescaler(pca->osc_hz, hz);
+	if (prescaler < 0) return PCA_ERR_FREQ;
+
+	// Les impulsions calibrées doivent tenir dans le nouveau cycle
+	uint16_t cycle_us = (uint16_t) (1000000UL / hz);
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++)
+		if (pca->calib[i].max_us >= cycle_us)
+			return PCA_ERR_CALIB_INVALID;
+
+	// Le diviseur ne peut être modifié qu'en sleep mode
+	int status = PCA9685_sleep(pca);
+	if (status != 0)
+		return status;
+
+	if (PCA9685_write(pca, PCA_REG_PRESCALER, (uint8_t) prescaler) != HAL_OK)
+		return PCA_ERR_INIT_PRESCALER;
+
+	uint16_t old_cycle_us = pca->cycle_us;
+	pca->prescaler = (uint8_t) prescaler;
+	pca->cycle_us = cycle_us;
+
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++) {
+		PCA9685_calib_apply(pca, i);
+
+		// On garde la durée d'impulsion et la phase des channels (sauf FULL_ON / FULL_OFF)
+		uint16_t on, off;
+		PCA9685_cache_get(pca, i, &on, &off);
+		if ((on | off) & 0x1000)
+			continue;
+
+		uint32_t width = (uint32_t) ((off - on) & 0xfff) * old_cycle_us / cycle_us;
+		if (width > 0xfff) width = 0xfff;
+		PCA9685_cache_set(pca, i, on, (on + width) & 0xfff);
+	}
+
+	// Les registres des channels peuvent être écrits pendant le sleep mode
+	status = PCA9685_flush(pca);
+	if (status != 0)
+		return status;
+
+	return PCA9685_resume(pca);
+}
+
+
+/*!
+ *  @brief Initialisation de la carte (bloquante)
+ *  @param pca La carte à initialiser (structure remplie par la fonction)
+ *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @param addr L'adresse I2C de la carte (PCA_I2C_ADDR + A5..A0 décalés d'un bit)
+ *  @return Si il y a eu une erreur pour l'écriture
+ *
+ *  Seules les PCA_CALIB_SLOTS premières adresses ont un emplacement de calibration
+ *  en flash : les cartes suivantes (A5..A0 >= 15) utilisent la calibration de pca9685.h
+ */
+int PCA9685_init(PCA9685_Handle *pca, I2C_HandleTypeDef *i2c, uint16_t addr) {
+	int status = PCA9685_init_async(pca, i2c, addr, NULL);
+	if (status != 0)
+		return status;
+
+	uint32_t start = HAL_GetTick();
+	while (pca->state == PCA_STATE_INIT || pca->state == PCA_STATE_SETTLE) {
+		if (HAL_GetTick() - start > PCA_QUEUE_TIMEOUT)
+			return PCA_ERR_INIT_WAKEUP;
+
+		PCA9685_watchdog(NULL);
+		PCA9685_settle(pca);
+	}
+
+	return pca->state == PCA_STATE_READY ? 0 : PCA_ERR_INIT_WAKEUP;
+}
+
+
+/*!
+ *  @brief Désactiver un channel
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à désactiver (0 à 15)
+ *  @return Un code d'erreur
+ *
+ *  Seul le bit FULL_OFF de OFF_H est modifié (cf. page 25) : les comptes sont
+ *  gardés et une seule donnée est envoyée
+ */
+int PCA9685_turn_off(PCA9685_Handle *pca, uint8_t channel) {
+    if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
+    if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+    uint16_t on, off;
+    PCA9685_cache_get(pca, channel, &on, &off);
+    PCA9685_cache_set(pca, channel, on, off | 0x1000);
+    return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Activer un channel en continu (cycle de 100%)
+ *  @param pca La carte à contrôler
+ *  @param channel Le channel à activer (0 à 15)
+ *  @return Un code d'erreur
+ *
+ *  Bit FULL_ON de ON_H, le bit FULL_OFF (prioritaire) est retiré (cf. page 25)
+ */
+int PCA9685_turn_on(PCA9685_Handle *pca, uint8_t channel) {
+    if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
+    if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+    uint16_t on, off;
+    PCA9685_cache_get(pca, channel, &on, &off);
+    PCA9685_cache_set(pca, channel, on | 0x1000, off & 0x0fff);
+    return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Décaler (ou non) le passage à l'état haut de chaque channel
+ *  @param pca La carte à contrôler
+ *  @param enable 1 pour répartir les fronts montants sur le cycle, 0 pour tous au compte 0
+ *  @return Un code d'erreur
+ *
+ *  Les servomoteurs ne tirent plus leur courant d'impulsion au même instant, ce qui
+ *  limite les chutes de l'alimentation. Les channels gardent leur durée d'impulsion
+ *  et sont renvoyés avec les écritures groupées habituelles
+ */
+int PCA9685_set_stagger(PCA9685_Handle *pca, uint8_t enable) {
+	pca->stagger = enable ? 1 : 0;
+
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++) {
+		uint16_t on, off;
+		PCA9685_cache_get(pca, i, &on, &off);
+
+		// Les comptes d'un channel FULL_ON / FULL_OFF sont recalculés à sa prochaine commande
+		if ((on | off) & 0x1000)
+			continue;
+
+		PCA9685_cache_set_width(pca, i, (off - on) & 0xfff);
+	}
+
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Directement définir la valeur du PWM
+ *  @param pca La carte à contrôler
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param points Le nombre de points ON (0 à max - min de la calibration du channel)
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_pwm(PCA9685_Handle *pca, uint8_t channel, float points) {
+	if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+	if (points < 0) return PCA_ERR_COUNT_TOO_SMALL;
+	if (points > PCA9685_scale_span(&pca->scale[channel])) return PCA_ERR_COUNT_TOO_BIG;
+
+	PCA9685_cache_set_width(pca, channel, PCA9685_points_to_count(&pca->scale[channel], (uint16_t) points));
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Définir un cycle de service
+ *  @param pca La carte à contrôler
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param duty_cycle La valeur du cycle (0 à 1)
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_cycle(PCA9685_Handle *pca, uint8_t channel, float duty_cycle) {
+	if (duty_cycle < 0) return PCA_ERR_CYCLE_TOO_SMALL;
+	if (duty_cycle > 1) return PCA_ERR_CYCLE_TOO_BIG;
+
+	return PCA9685_set_q15(pca, channel, (uint16_t) (duty_cycle*PCA_Q15_ONE));
+}
+
+
+/*!
+ *  @brief Convertir un setpoint Q15 en compte (multiplication et décalage entiers)
+ *  @param scale La conversion du channel
+ *  @param value Le setpoint (0 à PCA_Q15_ONE)
+ *  @return Le compte de passage à l'état bas
+ */
+static inline uint16_t PCA9685_q15_to_count(const PCA9685_Scale *scale, uint16_t value) {
+	return scale->offset + (((int32_t) value * scale->range) >> 15);
+}
+
+
+/*!
+ *  @brief Modifier un cycle de service en virgule fixe dans le cache, sans l'envoyer
+ *  @param pca La carte à contrôler
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param value La valeur du cycle en Q15 (0 à PCA_Q15_ONE)
+ *  @return Un code d'erreur
+ *
+ *  Pour regrouper plusieurs channels avant un seul PCA9685_flush
+ */
+int PCA9685_stage_q15(PCA9685_Handle *pca, uint8_t channel, uint16_t value) {
+	if (channel < 0) return PCA_ERR_CHAN_TOO_SMALL;
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+	if (value > PCA_Q15_ONE) return PCA_ERR_CYCLE_TOO_BIG;
+
+	PCA9685_cache_set_width(pca, channel, PCA9685_q15_to_count(&pca->scale[channel], value));
+	return 0;
+}
+
+
+/*!
+ *  @brief Définir un cycle de service en virgule fixe
+ *  @param pca La carte à contrôler
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param value La valeur du cycle en Q15 (0 à PCA_Q15_ONE)
+ *  @return Un code d'erreur
+ *
+ *  Aucun calcul flottant : utilisable sans FPU (-mfloat-abi=soft)
+ */
+int PCA9685_set_q15(PCA9685_Handle *pca, uint8_t channel, uint16_t value) {
+	int status = PCA9685_stage_q15(pca, channel, value);
+	if (status != 0)
+		return status;
+
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Définir un cycle de service en virgule fixe pour plusieurs channels consécutifs
+ *  @param pca La carte à contrôler
+ *  @param first Le premier channel à contrôler (0 à 15)
+ *  @param count Le nombre de channels à contrôler
+ *  @param values La valeur du cycle de chaque channel en Q15 (0 à PCA_Q15_ONE)
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_q15_range(PCA9685_Handle *pca, uint8_t first, uint8_t count, const uint16_t values[]) {
+	if (count == 0) return PCA_ERR_DATA_TOO_SMALL;
+	if (first + count > PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+	for (uint8_t i = 0; i < count; i++)
+		if (values[i] > PCA_Q15_ONE) return PCA_ERR_CYCLE_TOO_BIG;
+
+	for (uint8_t i = 0; i < count; i++)
+		PCA9685_cache_set_width(pca, first + i, PCA9685_q15_to_count(&pca->scale[first + i], values[i]));
+
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Définir la valeur du PWM de plusieurs channels consécutifs
+ *  @param pca La carte à contrôler
+ *  @param first Le premier channel à contrôler (0 à 15)
+ *  @param count Le nombre de channels à contrôler
+ *  @param points Le nombre de points ON de chaque channel (0 à max - min de sa calibration)
+ *  @return Un code d'erreur
+ *
+ *  Grâce à l'auto-increment (MODE1), tous les registres LEDn_ON/OFF modifiés
+ *  sont écrits en une seule transaction I2C (cf. page 10)
+ */
+int PCA9685_set_pwm_range(PCA9685_Handle *pca, uint8_t first, uint8_t count, const uint16_t points[]) {
+	if (count == 0) return PCA_ERR_DATA_TOO_SMALL;
+	if (first + count > PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+
+	for (uint8_t i = 0; i < count; i++)
+		if (points[i] > PCA9685_scale_span(&pca->scale[first + i])) return PCA_ERR_COUNT_TOO_BIG;
+
+	// Le signal passe à l'état haut au compte 0 (ou à sa phase) et à l'état bas offset + points plus tard
+	for (uint8_t i = 0; i < count; i++)
+		PCA9685_cache_set_width(pca, first + i, PCA9685_points_to_count(&pca->scale[first + i], points[i]));
+
+	return PCA9685_auto_flush(pca);
+}
+
+
+/*!
+ *  @brief Trouver la fin d'une écriture du cache
+ *  @param dirty Les octets à renvoyer
+ *  @param first Le premier octet de l'écriture (à renvoyer)
+ *  @return Le dernier octet de l'écriture
+ *
+ *  On étend l'écriture tant que l'écart jusqu'au prochain octet modifié est rentable
+ */
+static uint8_t PCA9685_flush_end(uint64_t dirty, uint8_t first) {
+	uint8_t last = first;
+	for (uint8_t j = first + 1; j < PCA_MAX_DATA_LEN; j++) {
+		if (dirty & (1ULL << j))
+			last = j;
+		else if (j - last > PCA_WRITE_OVERHEAD)
+			break;
+	}
+
+	return last;
+}
+
+
+/*!
+ *  @brief Compter les écritures nécessaires pour envoyer le cache
+ *  @param dirty Les octets à renvoyer
+ *  @return Le nombre d'écritures (cases de la file)
+ */
+static uint8_t PCA9685_flush_count(uint64_t dirty) {
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < PCA_MAX_DATA_LEN; i++) {
+		if (!(dirty & (1ULL << i)))
+			continue;
+
+		i = PCA9685_flush_end(dirty, i);
+		count++;
+	}
+
+	return count;
+}
+
+
+/*!
+ *  @brief Envoyer les registres modifiés depuis le dernier envoi
+ *  @param pca La carte à contrôler
+ *  @return Un code d'erreur
+ *
+ *  Seuls les octets modifiés sont envoyés (OFF_H seul si seul le bit FULL_OFF
+ *  change, par exemple). Deux suites d'octets modifiés séparées par au plus
+ *  PCA_WRITE_OVERHEAD octets inchangés partent en une seule écriture
+ *  (auto-increment) : renvoyer ces octets coûte moins qu'une nouvelle écriture.
+ *  Si les écritures ne tiennent pas dans les cases libres de la file, tout le cache
+ *  modifié part en une seule écriture, du premier au dernier octet modifié
+ */
+int PCA9685_flush(PCA9685_Handle *pca) {
+	uint8_t i = 0;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	uint8_t merge = PCA9685_flush_count(pca->dirty) > PCA9685_queue_free();
+	__set_PRIMASK(primask);
+
+	while (i < PCA_MAX_DATA_LEN) {
+		if (!(pca->dirty & (1ULL << i))) {
+			i++;
+			continue;
+		}
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		uint8_t first = i;
+		uint8_t last = merge ? 63 - __builtin_clzll(pca->dirty) : PCA9685_flush_end(pca->dirty, first);
+
+		// Les octets sont retirés avant l'envoi : une modification pendant l'écriture sera renvoyée
+		uint8_t len = last - first + 1;
+		uint64_t mask = PCA9685_byte_mask(first, len);
+		pca->dirty &= ~mask;
+		__set_PRIMASK(primask);
+
+		int status = PCA9685_write_data(pca, PCA_REG_CHAN0_ON_L + first, &pca->shadow[first], len);
+
+		// En cas d'erreur, les octets restent à renvoyer au prochain appel
+		if (status != HAL_OK) {
+			primask = __get_PRIMASK();
+			__disable_irq();
+			pca->dirty |= mask;
+			__set_PRIMASK(primask);
+			return status;
+		}
+
+		i = last + 1;
+	}
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Définir la valeur du PWM de tous les channels d'une carte
+ *  @param pca La carte à contrôler
+ *  @param points Le nombre de points ON (0 à max - min de la calibration du channel 0)
+ *  @return Un code d'erreur
+ *
+ *  Une seule écriture sur les registres ALL_LED (cf. page 25), au lieu de 16.
+ *  Tous les channels prennent la calibration du channel 0 et passent à l'état
+ *  haut au compte 0 (sans décalage de phase)
+ */
+int PCA9685_set_pwm_all(PCA9685_Handle *pca, uint16_t points) {
+	if (points > PCA9685_scale_span(&pca->scale[0])) return PCA_ERR_COUNT_TOO_BIG;
+
+	uint16_t off_count = PCA9685_points_to_count(&pca->scale[0], points);
+	uint8_t data[PCA_CHANNEL_SIZE] = {0x00, 0x00, off_count & 0xff, (off_count >> 8) & 0xff};
+
+	int status = PCA9685_write_data(pca, PCA_REG_ALL_ON_L, data, PCA_CHANNEL_SIZE);
+	if (status != HAL_OK)
+		return status;
+
+	PCA9685_cache_set_all(pca, 0x0000, off_count);
+	return 0;
+}
+
+
+/*!
+ *  @brief Désactiver tous les channels d'une carte
+ *  @param pca La carte à contrôler
+ *  @return Un code d'erreur
+ */
+int PCA9685_turn_off_all(PCA9685_Handle *pca) {
+	uint8_t data[PCA_CHANNEL_SIZE] = {0x00, 0x00, 0x00, 0x10};
+
+	int status = PCA9685_write_data(pca, PCA_REG_ALL_ON_L, data, PCA_CHANNEL_SIZE);
+	if (status != HAL_OK)
+		return status;
+
+	PCA9685_cache_set_all(pca, 0x0000, 0x1000);
+	return 0;
+}
+
+
+/*!
+ *  @brief Faire répondre une carte à une sous-adresse (cf. pages 7 et 14)
+ *  @param pca La carte à configurer
+ *  @param sub La sous-adresse à utiliser (1 à 3)
+ *  @param addr L'adresse I2C décalée du groupe (bit 0 à 0)
+ *  @return Un code d'erreur
+ */
+int PCA9685_set_subaddr(PCA9685_Handle *pca, uint8_t sub, uint16_t addr) {
+	if (sub < 1) return PCA_ERR_SUBADDR;
+	if (sub > 3) return PCA_ERR_SUBADDR;
+
+	if (PCA9685_write(pca, PCA_REG_SUBADR1 + sub - 1, addr & 0xfe) != HAL_OK)
+		return PCA_ERR_SUBADDR;
+
+	// SUB1 est le bit 3 de MODE1, SUB2 le bit 2 et SUB3 le bit 1
+	pca->mode1 |= PCA_MODE1_SUB1 >> (sub - 1);
+	return PCA9685_write(pca, PCA_REG_MODE1, PCA9685_mode1(pca));
+}
+
+
+/*!
+ *  @brief Définir la valeur du PWM de tous les channels de toutes les cartes d'un groupe
+ *  @param group Le groupe à contrôler
+ *  @param points Le nombre de points ON (0 à max - min de la calibration)
+ *  @return Un code d'erreur
+ *
+ *  Une seule écriture ALL_LED à l'adresse du groupe (All Call ou sous-adresse).
+ *  Tous les channels prennent la calibration du channel 0 de la première carte
+ */
+int PCA9685_group_set_pwm_all(PCA9685_Group *group, uint16_t points) {
+	if (group->board_count == 0) return PCA_ERR_DATA_TOO_SMALL;
+
+	PCA9685_Handle *ref = group->boards[0];
+	if (points > PCA9685_scale_span(&ref->scale[0])) return PCA_ERR_COUNT_TOO_BIG;
+
+	uint16_t off_count = PCA9685_points_to_count(&ref->scale[0], points);
+	uint8_t data[PCA_CHANNEL_SIZE] = {0x00, 0x00, off_count & 0xff, (off_count >> 8) & 0xff};
+
+	int status = PCA9685_transmit_to(NULL, group->i2c, group->addr, PCA_REG_ALL_ON_L, data, PCA_CHANNEL_SIZE);
+	if (status != HAL_OK)
+		return status;
+
+	for (uint8_t i = 0; i < group->board_count; i++)
+		PCA9685_cache_set_all(group->boards[i], 0x0000, off_count);
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Désactiver tous les channels de toutes les cartes d'un groupe
+ *  @param group Le groupe à contrôler
+ *  @return Un code d'erreur
+ */
+int PCA9685_group_turn_off_all(PCA9685_Group *group) {
+	uint8_t data[PCA_CHANNEL_SIZE] = {0x00, 0x00, 0x00, 0x10};
+
+	int status = PCA9685_transmit_to(NULL, group->i2c, group->addr, PCA_REG_ALL_ON_L, data, PCA_CHANNEL_SIZE);
+	if (status != HAL_OK)
+		return status;
+
+	for (uint8_t i = 0; i < group->board_count; i++)
+		PCA9685_cache_set_all(group->boards[i], 0x0000, 0x1000);
+
+	return 0;
+}
+
+
+#if PCA_SCRUB_PERIOD
+// Vérification des registres : carte, étape (MODE1, PRE_SCALE puis channels) et dernière lecture
+static uint8_t scrub_board = 0;
+static uint8_t scrub_step = 0;
+static uint32_t scrub_tick;
+static uint8_t scrub_reading = 0;               // Lecture lancée, pas encore comparée
+static uint8_t scrub_data[PCA_SCRUB_CHUNK];     // Registres lus (écrits par le DMA)
+static uint8_t scrub_snapshot[PCA_SCRUB_CHUNK]; // Valeurs attendues au lancement de la lecture
+static uint64_t scrub_dirty;                    // Octets à renvoyer au lancement de la lecture
+
+
+/*!
+ *  @brief Lancer la lecture de registres successifs d'une carte dans scrub_data (cf. page 11)
+ *  @param pca La carte à lire
+ *  @param reg L'adresse du premier registre
+ *  @param len Le nombre de registres à lire
+ *  @return Le statut HAL du lancement (HAL_BUSY si le bus n'est pas libre)
+ *
+ *  Avec PCA_USE_DMA, la lecture est lancée en DMA seulement quand la file est vide et
+ *  la fonction retourne tout de suite : la fin est signalée par queue_read_done, les
+ *  écritures ajoutées entre-temps attendent dans la file. Sans DMA, la lecture est bloquante
+ */
+static int PCA9685_read(PCA9685_Handle *pca, uint8_t reg, uint8_t len) {
+#if PCA_USE_DMA
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (!PCA9685_queue_idle() || recovering) {
+		__set_PRIMASK(primask);
+		return HAL_BUSY;
+	}
+
+	queue_reading = 1;
+	queue_read_done = 0;
+	queue_read_i2c = pca->i2c;
+	queue_tick = HAL_GetTick();
+
+	int status = HAL_I2C_Mem_Read_DMA(pca->i2c, pca->addr, reg, I2C_MEMADD_SIZE_8BIT, scrub_data, len);
+	if (status != HAL_OK) {
+		queue_reading = 0;
+		PCA9685_queue_next();
+	}
+
+	__set_PRIMASK(primask);
+	return status;
+#else
+	int status = HAL_I2C_Mem_Read(pca->i2c, pca->addr, reg, I2C_MEMADD_SIZE_8BIT, scrub_data, len, PCA_I2C_TIMEOUT);
+
+	if (status != HAL_OK && PCA9685_count_error(status == HAL_TIMEOUT ? HAL_I2C_ERROR_TIMEOUT : pca->i2c->ErrorCode) && !recovering && __get_IPSR() == 0)
+		PCA9685_recover(pca->i2c);
+
+	return status;
+#endif
+}
+
+
+/*!
+ *  @brief Savoir si la lecture lancée par PCA9685_read est terminée
+ *  @return HAL_OK si les registres sont dans scrub_data, HAL_BUSY si la lecture
+ *  est en cours, HAL_ERROR si elle a échoué ou a été abandonnée
+ */
+static int PCA9685_read_status(void) {
+#if PCA_USE_DMA
+	if (queue_reading)
+		return HAL_BUSY;
+
+	return queue_read_done ? HAL_OK : HAL_ERROR;
+#else
+	return HAL_OK;
+#endif
+}
+
+
+/*!
+ *  @brief Réécrire toute la configuration d'une carte qui a redémarré
+ *  @param pca La carte
+ *  @return Un code d'erreur
+ *
+ *  Après une chute d'alimentation, la carte revient en sleep mode avec ses registres
+ *  par défaut (cf. page 13) : MODE2, PRE_SCALE et les 16 channels sont renvoyés
+ *  avant de la réveiller (RESTART par PCA9685_poll)
+ */
+static int PCA9685_restore(PCA9685_Handle *pca) {
+	uint8_t wake = pca->state == PCA_STATE_READY;
+	int status = 0;
+
+	PCA9685_errors.resets++;
+	if (wake)
+		pca->state = PCA_STATE_SLEEP;
+
+	// SLEEP d'abord, EXTCLK n'est pris en compte qu'une fois la carte en sleep mode (cf. page 14)
+	if (PCA9685_write(pca, PCA_REG_MODE1, (pca->mode1 & ~PCA_MODE1_EXTCLK) | PCA_MODE1_SLEEP) != HAL_OK)
+		status = PCA_ERR_INIT_SLEEP;
+
+#if PCA_EXTCLK_FREQ
+	else if (PCA9685_write(pca, PCA_REG_MODE1, pca->mode1 | PCA_MODE1_SLEEP) != HAL_OK)
+		status = PCA_ERR_INIT_SLEEP;
+#endif
+
+	else if (PCA9685_write(pca, PCA_REG_MODE2, 0b00000000) != HAL_OK)
+		status = PCA_ERR_INIT_MODE2;
+
+	else if (PCA9685_write(pca, PCA_REG_PRESCALER, pca->prescaler) != HAL_OK)
+		status = PCA_ERR_INIT_PRESCALER;
+
+	if (status == 0) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		pca->dirty = PCA_DIRTY_ALL;
+		__set_PRIMASK(primask);
+
+		status = PCA9685_flush(pca);
+	}
+
+	// En cas d'erreur, la carte sera de nouveau détectée à la prochaine vérification
+	if (status != 0) {
+		if (wake)
+			pca->state = PCA_STATE_READY;
+		return status;
+	}
+
+	return wake ? PCA9685_resume(pca) : 0;
+}
+
+
+/*!
+ *  @brief Comparer des registres de channels lus avec le cache et renvoyer les différences
+ *  @param pca La carte
+ *  @param first Le premier octet du cache lu
+ *  @param data Les valeurs lues
+ *  @param len Le nombre d'octets lus
+ *  @param snapshot Le cache copié juste avant la lecture
+ *  @param dirty Les octets à renvoyer juste avant la lecture
+ *  @return Un code d'erreur
+ *
+ *  La lecture est comparée à la copie : un channel modifié depuis une interruption
+ *  pendant la lecture n'est pas compté comme une erreur de la carte
+ */
+static int PCA9685_scrub_channels(PCA9685_Handle *pca, uint8_t first, const uint8_t *data, uint8_t len,
+		const uint8_t *snapshot, uint64_t dirty) {
+	uint64_t diff = 0;
+
+	for (uint8_t i = 0; i < len; i++)
+		if (data[i] != snapshot[i])
+			diff |= 1ULL << (first + i);
+
+	// Les octets pas encore envoyés diffèrent normalement de la carte
+	diff &= ~dirty;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	// Un octet modifié depuis la copie a déjà sa nouvelle valeur à envoyer
+	for (uint8_t i = 0; i < len; i++)
+		if (pca->shadow[first + i] != snapshot[i])
+			diff &= ~(1ULL << (first + i));
+
+	pca->dirty |= diff;
+
+	__set_PRIMASK(primask);
+
+	if (diff == 0)
+		return 0;
+
+	PCA9685_errors.scrubbed += __builtin_popcountll(diff);
+	return PCA9685_flush(pca);
+}
+#endif
+
+
+#if PCA_SCRUB_PERIOD
+/*!
+ *  @brief Comparer la lecture terminée de l'étape en cours avec le cache
+ *  @param pca La carte lue
+ *  @return Un code d'erreur
+ *
+ *  La lecture a pu durer pendant que la boucle principale continuait : une valeur lue
+ *  qui correspond à celle attendue au lancement ou à celle attendue maintenant est juste
+ */
+static int PCA9685_scrub_check(PCA9685_Handle *pca) {
+	// La carte a pu être arrêtée pendant la lecture
+	if (pca->state != PCA_STATE_READY && pca->state != PCA_STATE_SLEEP)
+		return 0;
+
+	if (scrub_step == 0) {
+		// Une carte qui a redémarré est en sleep mode, sans auto-increment, avec MODE2 à 0x04
+		uint8_t mode1 = scrub_data[0] & ~PCA_MODE1_RESTART;
+		if ((mode1 != scrub_snapshot[0] && mode1 != PCA9685_mode1(pca)) || scrub_data[1] != 0x00)
+			return PCA9685_restore(pca);
+		return 0;
+	}
+
+	if (scrub_step == 1) {
+		if (scrub_data[0] != scrub_snapshot[0] && scrub_data[0] != pca->prescaler)
+			return PCA9685_restore(pca);
+		return 0;
+	}
+
+	uint8_t first = (scrub_step - 2) * PCA_SCRUB_CHUNK;
+	return PCA9685_scrub_channels(pca, first, scrub_data, PCA_SCRUB_CHUNK, scrub_snapshot, scrub_dirty);
+}
+
+
+/*!
+ *  @brief Passer à l'étape suivante de la vérification (ou à la carte suivante)
+ */
+static void PCA9685_scrub_next(void) {
+	if (++scrub_step >= 2 + PCA_MAX_DATA_LEN / PCA_SCRUB_CHUNK) {
+		scrub_step = 0;
+		scrub_board++;
+	}
+}
+
+
+/*!
+ *  @brief Terminer l'étape en cours si sa lecture est finie, puis passer à la suivante
+ *  @param pca La carte lue
+ *  @return Un code d'erreur (HAL_BUSY si la lecture est encore en cours)
+ */
+static int PCA9685_scrub_finish(PCA9685_Handle *pca) {
+	int status = PCA9685_read_status();
+
+	// Une lecture trop longue est abandonnée par PCA9685_watchdog (PCA_I2C_TIMEOUT)
+	if (status == HAL_BUSY) {
+		PCA9685_watchdog(pca->i2c);
+		return HAL_BUSY;
+	}
+
+	scrub_reading = 0;
+
+	// Lecture en erreur : le bus est libéré si besoin
+	if (status != HAL_OK)
+		PCA9685_watchdog(pca->i2c);
+	else
+		status = PCA9685_scrub_check(pca);
+
+	PCA9685_scrub_next();
+	return status;
+}
+#endif
+
+
+/*!
+ *  @brief Vérifier une partie des registres d'une carte et réécrire ce qui diffère du cache
+ *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @return Un code d'erreur
+ *
+ *  A appeler dans la boucle principale. Une lecture au plus toutes les PCA_SCRUB_PERIOD ms,
+ *  seulement quand aucune écriture n'est en attente : MODE1/MODE2, puis PRE_SCALE, puis les
+ *  channels par PCA_SCRUB_CHUNK octets, puis la carte suivante de ce bus. Une carte qui a
+ *  redémarré (MODE1, MODE2 ou PRE_SCALE différents) est entièrement réécrite.
+ *
+ *  Avec PCA_USE_DMA, un appel lance la lecture et retourne tout de suite, la comparaison
+ *  est faite par un des appels suivants, une fois la lecture terminée
+ */
+int PCA9685_scrub(I2C_HandleTypeDef *i2c) {
+#if PCA_SCRUB_PERIOD
+	if (scrub_reading) {
+		if (handles[scrub_board]->i2c != i2c)
+			return 0;
+
+		int status = PCA9685_scrub_finish(handles[scrub_board]);
+		return status == HAL_BUSY ? 0 : status;
+	}
+
+	if (HAL_GetTick() - scrub_tick < PCA_SCRUB_PERIOD) return 0;
+	if (!PCA9685_queue_idle() || recovering || handle_count == 0) return 0;
+
+	// Prochaine carte de ce bus prête ou en veille
+	PCA9685_Handle *pca = NULL;
+	for (uint8_t n = 0; n <= handle_count && pca == NULL; n++) {
+		if (scrub_board >= handle_count) {
+			scrub_board = 0;
+			scrub_step = 0;
+		}
+
+		PCA9685_Handle *h = handles[scrub_board];
+		if (h->i2c == i2c && (h->state == PCA_STATE_READY || h->state == PCA_STATE_SLEEP))
+			pca = h;
+		else {
+			scrub_board++;
+			scrub_step = 0;
+		}
+	}
+
+	if (pca == NULL)
+		return 0;
+
+	scrub_tick = HAL_GetTick();
+
+	// Valeurs attendues au lancement, une écriture pendant la lecture ne compte pas comme une erreur
+	uint8_t reg, len;
+	if (scrub_step == 0) {
+		reg = PCA_REG_MODE1;
+		len = 2;
+		scrub_snapshot[0] = PCA9685_mode1(pca);
+	} else if (scrub_step == 1) {
+		reg = PCA_REG_PRESCALER;
+		len = 1;
+		scrub_snapshot[0] = pca->prescaler;
+	} else {
+		uint8_t first = (scrub_step - 2) * PCA_SCRUB_CHUNK;
+		reg = PCA_REG_CHAN0_ON_L + first;
+		len = PCA_SCRUB_CHUNK;
+
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		memcpy(scrub_snapshot, &pca->shadow[first], PCA_SCRUB_CHUNK);
+		scrub_dirty = pca->dirty;
+		__set_PRIMASK(primask);
+	}
+
+	int status = PCA9685_read(pca, reg, len);
+
+	// Le bus n'était pas libre : la même étape sera refaite
+	if (status == HAL_BUSY)
+		return 0;
+
+	if (status != HAL_OK) {
+		PCA9685_scrub_next();
+		return status;
+	}
+
+	scrub_reading = 1;
+
+#if PCA_USE_DMA
+	return 0;
+#else
+	// Sans DMA la lecture est déjà terminée
+	return PCA9685_scrub_finish(pca);
+#endif
+#else
+	return 0;
+#endif
+}
+
+
+/*!
+ *  @brief Calculer le registre TIMINGR de l'I2C (cf. RM0394, section 37.4.9)
+ *  @param clk La fréquence de l'horloge de l'I2C (Hz)
+ *  @param speed La fréquence du bus voulue (100000, 400000 ou 1000000 Hz)
+ *  @return La valeur de TIMINGR, 0 si la fréquence ne peut pas être atteinte
+ *
+ *  Les durées minimales sont celles de la norme I2C pour chaque mode. Les délais
+ *  de synchronisation sont estimés à 2 cycles par front plus le filtre analogique
+ */
+static uint32_t PCA9685_i2c_timing(uint32_t clk, uint32_t speed) {
+	uint32_t low_ns, high_ns, setup_ns;
+
+	if (speed <= 100000) {
+		low_ns = 4700; high_ns = 4000; setup_ns = 250;
+	} else if (speed <= 400000) {
+		low_ns = 1300; high_ns = 600; setup_ns = 100;
+	} else {
+		low_ns = 500; high_ns = 260; setup_ns = 50;
+	}
+
+	// Nombre de cycles de l'horloge I2C par période SCL, hors synchronisation
+	uint32_t sync = 4 + (clk / 1000000 * 100 + 999) / 1000;
+	if (clk / speed <= sync)
+		return 0;
+
+	for (uint32_t presc = 0; presc < 16; presc++) {
+		uint32_t tick = clk / (presc + 1);
+		uint32_t total = (clk / speed - sync) / (presc + 1);
+
+		uint32_t low = (uint32_t) (((uint64_t) low_ns * tick + 999999999) / 1000000000);
+		uint32_t high = (uint32_t) (((uint64_t) high_ns * tick + 999999999) / 1000000000);
+		uint32_t scldel = (uint32_t) (((uint64_t) setup_ns * tick + 999999999) / 1000000000);
+
+		// Trop rapide pour cette horloge : un prescaler plus grand ne ferait qu'empirer
+		if (low + high > total)
+			return 0;
+
+		// Le temps restant est partagé entre l'état bas et l'état haut
+		uint32_t extra = total - low - high;
+		low += (extra + 1) / 2;
+		high += extra / 2;
+
+		if (low > 256 || high > 256)
+			continue;
+
+		if (scldel < 1) scldel = 1;
+		if (scldel > 16) scldel = 16;
+
+		return (presc << I2C_TIMINGR_PRESC_Pos) | ((scldel - 1) << I2C_TIMINGR_SCLDEL_Pos)
+				| ((high - 1) << I2C_TIMINGR_SCLH_Pos) | ((low - 1) << I2C_TIMINGR_SCLL_Pos);
+	}
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Changer la fréquence du bus I2C (100kHz, 400kHz ou 1MHz)
+ *  @param i2c Généralement &hi2c1 (structure d'STM pour gérer l'I2C)
+ *  @param speed La fréquence voulue (Hz)
+ *  @return Un code d'erreur
+ *
+ *  Le registre TIMINGR est calculé pour l'horloge actuelle de l'I2C (PCLK1).
+ *  Au-delà de 400kHz, le mode Fast-mode Plus (sorties 20mA) est activé sur
+ *  les broches de l'I2C1. Les transferts en attente sont envoyés avant
+ */
+int PCA9685_set_speed(I2C_HandleTypeDef *i2c, uint32_t speed) {
+	uint32_t timing = PCA9685_i2c_timing(HAL_RCC_GetPCLK1Freq(), speed);
+	if (timing == 0) return PCA_ERR_SPEED;
+
+	if (PCA9685_wait(PCA_QUEUE_TIMEOUT) != 0)
+		return PCA_ERR_QUEUE_TIMEOUT;
+
+	__HAL_I2C_DISABLE(i2c);
+	i2c->Init.Timing = timing;
+	i2c->Instance->TIMINGR = timing;
+
+	if (speed > 400000)
+		HAL_I2CEx_EnableFastModePlus(I2C_FASTMODEPLUS_I2C1);
+	else
+		HAL_I2CEx_DisableFastModePlus(I2C_FASTMODEPLUS_I2C1);
+
+	__HAL_I2C_ENABLE(i2c);
+	return 0;
+}
+
+
+#if PCA_MEASURE
+/*!
+ *  @brief Lire les mesures de durée des transferts
+ *  @param out Les mesures (copiées)
+ */
+void PCA9685_get_stats(PCA9685_Stats *out) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*out = stats;
+	__set_PRIMASK(primask);
+}
+
+
+/*!
+ *  @brief Remettre les mesures à zéro
+ */
+void PCA9685_reset_stats(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memset(&stats, 0, sizeof(stats));
+	__set_PRIMASK(primask);
 }
+#endif
@@ -0,0 +1,332 @@
+/*!
+ *  @version 1.0
+ *  @file    pca9685_motion.c
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Profils de mouvement (trapèze et courbe en S) des servomoteurs d'un PCA9685
+ */
+
+#include <string.h>
+#include "pca9685_motion.h"
+
+
+static PCA9685_Motion *boards[PCA_MOTION_BOARDS];
+static uint8_t board_count = 0;
+
+
+/*!
+ *  @brief Enregistrer une carte pour qu'elle soit mise à jour par PCA9685_motion_poll
+ *  @param motion Les trajectoires de la carte (structure remplie par la fonction)
+ *  @param pca La carte à contrôler (déjà initialisée)
+ *  @return Un code d'erreur
+ *
+ *  Aucun channel n'est piloté tant que PCA9685_motion_config n'a pas été appelé
+ */
+int PCA9685_motion_attach(PCA9685_Motion *motion, PCA9685_Handle *pca) {
+	if (board_count >= PCA_MOTION_BOARDS) return PCA_ERR_MOTION_FULL;
+
+	memset(motion, 0, sizeof(PCA9685_Motion));
+	motion->pca = pca;
+	motion->frame_ms = (pca->cycle_us + 500) / 1000;
+
+	boards[board_count++] = motion;
+	return 0;
+}
+
+
+/*!
+ *  @brief Confier un channel au moteur de mouvement
+ *  @param motion Les trajectoires de la carte
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param position La position actuelle du servomoteur (Q15, 0 à PCA_Q15_ONE)
+ *  @param max_vel La vitesse maximale ((Q15 << PCA_MOTION_FRAC) par frame)
+ *  @param max_acc L'accélération maximale ((Q15 << PCA_MOTION_FRAC) par frame²)
+ *  @param max_jerk Le jerk maximal ((Q15 << PCA_MOTION_FRAC) par frame³, 0 pour un trapèze)
+ *  @return Un code d'erreur
+ *
+ *  Le channel ne doit plus être modifié directement (PCA9685_set_pwm, ...) ensuite
+ */
+int PCA9685_motion_config(PCA9685_Motion *motion, uint8_t channel, uint16_t position,
+		int32_t max_vel, int32_t max_acc, int32_t max_jerk) {
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+	if (position > PCA_Q15_ONE) return PCA_ERR_CYCLE_TOO_BIG;
+
+	PCA9685_Axis *axis = &motion->axis[channel];
+
+	axis->enabled = 0;
+	axis->target = position;
+	axis->pos = (int32_t) position << PCA_MOTION_FRAC;
+	axis->vel = 0;
+	axis->acc = 0;
+	axis->max_vel = max_vel;
+	axis->max_acc = max_acc;
+	axis->max_jerk = max_jerk;
+	axis->enabled = 1;
+
+	return 0;
+}
+
+
+/*!
+ *  @brief Définir la position visée d'un channel
+ *  @param motion Les trajectoires de la carte
+ *  @param channel Le servomoteur à contrôler (0 à 15)
+ *  @param target La position visée (Q15, 0 à PCA_Q15_ONE)
+ *  @return Un code d'erreur
+ *
+ *  Retourne immédiatement : le mouvement est calculé à chaque frame par
+ *  PCA9685_motion_update, sans boucle bloquante dans l'application
+ */
+int PCA9685_motion_move(PCA9685_Motion *motion, uint8_t channel, uint16_t target) {
+	if (channel >= PCA_CHANNEL_COUNT) return PCA_ERR_CHAN_TOO_BIG;
+	if (target > PCA_Q15_ONE) return PCA_ERR_CYCLE_TOO_BIG;
+	if (!motion->axis[channel].enabled) return PCA_ERR_MOTION_DISABLED;
+
+	motion->axis[channel].target = target;
+	return 0;
+}
+
+
+/*!
+ *  @brief Savoir si un channel a atteint sa position visée
+ *  @param motion Les trajectoires de la carte
+ *  @param channel Le servomoteur (0 à 15)
+ *  @return 1 si le mouvement est terminé, 0 sinon
+ */
+int PCA9685_motion_done(PCA9685_Motion *motion, uint8_t channel) {
+	if (channel >= PCA_CHANNEL_COUNT) return 1;
+
+	PCA9685_Axis *axis = &motion->axis[channel];
+	return axis->vel == 0 && axis->pos == ((int32_t) axis->target << PCA_MOTION_FRAC);
+}
+
+
+/*!
+ *  @brief Faire varier l'accélération vers une valeur au jerk maximal
+ *  @param axis La trajectoire du servomoteur
+ *  @param acc L'accélération actuelle
+ *  @param acc_target L'accélération visée
+ *  @return La nouvelle accélération
+ */
+static int32_t PCA9685_motion_jerk(const PCA9685_Axis *axis, int32_t acc, int32_t acc_target) {
+	if (axis->max_jerk == 0)
+		return acc_target;
+	if (acc_target > acc)
+		return (acc + axis->max_jerk < acc_target) ? acc + axis->max_jerk : acc_target;
+
+	return (acc - axis->max_jerk > acc_target) ? acc - axis->max_jerk : acc_target;
+}
+
+
+/*!
+ *  @brief Accélération visée pendant un freinage
+ *  @param axis La trajectoire du servomoteur
+ *  @param vel La vitesse vers la cible (positive)
+ *  @param acc L'accélération actuelle
+ *  @return -A, ou 0 quand ramener l'accélération à 0 suffit pour s'arrêter (v <= a² / 2J)
+ */
+static int32_t PCA9685_motion_brake_acc(const PCA9685_Axis *axis, int32_t vel, int32_t acc) {
+	if (axis->max_jerk != 0 && acc < 0 && 2 * (int64_t) axis->max_jerk * vel <= (int64_t) acc * acc)
+		return 0;
+
+	return -axis->max_acc;
+}
+
+
+/*!
+ *  @brief Distance parcourue par un freinage en courbe en S commencé à la prochaine frame
+ *  @param axis La trajectoire du servomoteur
+ *  @param vel La vitesse vers la cible
+ *  @param acc L'accélération actuelle (dans le sens de la cible)
+ *  @return La distance jusqu'à l'arrêt
+ *
+ *  Le freinage de PCA9685_motion_step est simulé frame par frame : une accélération
+ *  encore positive est d'abord ramenée à -A (terme a² / 2J des formules continues),
+ *  puis revient à 0 avant l'arrêt. Environ (a + 2A) / J + v / A itérations
+ */
+static int64_t PCA9685_motion_stop_dist(const PCA9685_Axis *axis, int32_t vel, int32_t acc) {
+	int64_t dist = 0;
+
+	while (vel > 0) {
+		acc = PCA9685_motion_jerk(axis, acc, PCA9685_motion_brake_acc(axis, vel, acc));
+		vel += acc;
+		if (vel > 0)
+			dist += vel;
+	}
+
+	return dist;
+}
+
+
+/*!
+ *  @brief Savoir s'il faut freiner pour s'arrêter sur la cible
+ *  @param axis La trajectoire du servomoteur
+ *  @param dist La distance restante (positive)
+ *  @param vel La vitesse vers la cible (positive si on s'en rapproche)
+ *  @param acc L'accélération actuelle (dans le sens de la cible)
+ *  @return 1 s'il faut freiner, 0 sinon
+ *
+ *  Trapèze : v² / 2A >= d
+ *  Courbe en S : on freine si une frame de plus sans freiner ne permettrait plus de
+ *  s'arrêter avant la cible (l'accélération en cours est comptée)
+ */
+static int PCA9685_motion_must_brake(const PCA9685_Axis *axis, int64_t dist, int32_t vel, int32_t acc) {
+	if (vel <= 0) return 0;
+
+	int64_t a = axis->max_acc;
+
+	if (axis->max_jerk == 0)
+		return (int64_t) vel*vel >= 2*a*dist;
+
+	// Frame suivante sans freinage, comme dans PCA9685_motion_step
+	int32_t acc_target = vel < axis->max_vel ? axis->max_acc : 0;
+	int32_t next_acc = PCA9685_motion_jerk(axis, acc, acc_target);
+	int32_t next_vel = vel + next_acc;
+	if (next_vel > axis->max_vel) next_vel = axis->max_vel;
+
+	return next_vel + PCA9685_motion_stop_dist(axis, next_vel, next_acc) > dist;
+}
+
+
+/*!
+ *  @brief Avancer la trajectoire d'un servomoteur d'une frame
+ *  @param axis La trajectoire du servomoteur
+ *  @return 1 si la position a changé, 0 sinon
+ */
+static int PCA9685_motion_step(PCA9685_Axis *axis) {
+	int32_t target = (int32_t) axis->target << PCA_MOTION_FRAC;
+	int32_t err = target - axis->pos;
+
+	if (err == 0 && axis->vel == 0) {
+		axis->acc = 0;
+		return 0;
+	}
+
+	// Pas de limite de vitesse : saut direct
+	if (axis->max_vel == 0) {
+		axis->pos = target;
+		axis->vel = 0;
+		axis->acc = 0;
+		return 1;
+	}
+
+	// Les calculs sont faits dans le sens de la cible
+	int32_t dir = err >= 0 ? 1 : -1;
+	int32_t dist = err*dir;
+	int32_t vel = axis->vel*dir;
+	int32_t acc = axis->acc*dir;
+
+	if (axis->max_acc == 0) {
+		// Pas de limite d'accélération : vitesse constante
+		vel = dist < axis->max_vel ? dist : axis->max_vel;
+		acc = 0;
+	} else {
+		int32_t acc_target = axis->max_acc;
+		if (PCA9685_motion_must_brake(axis, dist, vel, acc))
+			acc_target = PCA9685_motion_brake_acc(axis, vel, acc);
+		else if (vel > axis->max_vel)
+			acc_target = -axis->max_acc;
+		else if (vel == axis->max_vel)
+			acc_target = 0;
+
+		// Le jerk limite la variation de l'accélération (courbe en S)
+		acc = PCA9685_motion_jerk(axis, acc, acc_target);
+
+		int32_t prev = vel;
+		vel += acc;
+		if (vel > axis->max_vel) vel = axis->max_vel;
+		if (vel < -axis->max_vel) vel = -axis->max_vel;
+
+		// Le freinage ne doit pas faire repartir le servomoteur en arrière
+		if (prev >= 0 && vel < 0) {
+			vel = 0;
+			acc = 0;
+		}
+	}
+
+	axis->pos += vel*dir;
+	axis->vel = vel*dir;
+	axis->acc = acc*dir;
+
+	// Cible dépassée, ou assez proche et assez lent pour s'arrêter dessus
+	int32_t left = (target - axis->pos)*dir;
+	int32_t snap = axis->max_acc > 0 ? axis->max_acc : axis->max_vel;
+
+	if (left <= 0 || (left <= snap && vel <= snap)) {
+		axis->pos = target;
+		axis->vel = 0;
+		axis->acc = 0;
+	}
+
+	return 1;
+}
+
+
+/*!
+ *  @brief Avancer d'une frame toutes les trajectoires d'une carte
+ *  @param motion Les trajectoires de la carte
+ *  @return Un code d'erreur
+ *
+ *  Les channels qui bougent sont modifiés dans le cache puis envoyés par un
+ *  seul PCA9685_flush (les channels consécutifs partent en une écriture)
+ */
+int PCA9685_motion_update(PCA9685_Motion *motion) {
+	uint8_t moved = 0;
+
+	for (uint8_t i = 0; i < PCA_CHANNEL_COUNT; i++) {
+		PCA9685_Axis *axis = &motion->axis[i];
+
+		if (!axis->enabled || !PCA9685_motion_step(axis))
+			continue;
+
+		PCA9685_stage_q15(motion->pca, i, (uint16_t) (axis->pos >> PCA_MOTION_FRAC));
+		moved = 1;
+	}
+
+	if (!moved)
+		return 0;
+
+	return PCA9685_flush(motion->pca);
+}
+
+
+/*!
+ *  @brief Compter les frames PWM des cartes enregistrées
+ *  @note A appeler toutes les millisecondes (SysTick_Handler)
+ *
+ *  Aucun transfert I2C en interruption : la frame est seulement marquée à
+ *  calculer, PCA9685_motion_poll fait la mise à jour et l'envoi
+ */
+void PCA9685_motion_tick(void) {
+	for (uint8_t i = 0; i < board_count; i++) {
+		PCA9685_Motion *motion = boards[i];
+
+		// Suit les changements de fréquence (PCA9685_set_frequency)
+		motion->frame_ms = (motion->pca->cycle_us + 500) / 1000;
+
+		if (++motion->elapsed_ms < motion->frame_ms)
+			continue;
+
+		motion->elapsed_ms = 0;
+		motion->due = 1;
+	}
+}
+
+
+/*!
+ *  @brief Avancer d'une frame les cartes dont la frame PWM est écoulée
+ *  @note A appeler dans la boucle principale
+ *
+ *  Sans PCA_USE_DMA, PCA9685_flush est bloquant et son timeout dépend de
+ *  HAL_GetTick : il ne doit pas être appelé depuis SysTick_Handler
+ */
+void PCA9685_motion_poll(void) {
+	for (uint8_t i = 0; i < board_count; i++) {
+		PCA9685_Motion *motion = boards[i];
+		if (!motion->due)
+			continue;
+
+		motion->due = 0;
+		PCA9685_motion_update(motion);
+	}
+}
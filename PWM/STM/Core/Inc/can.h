@@ -15,8 +15,54 @@
 #include "stm32l4xx_hal.h"
 #include <robotech/can_vars.h>
 
+// Codes fonction des scripts d'actionneurs (pwm_script.h), absents de CAN_FCT_CODE (robotech/can_vars.h)
+#define FCT_LANCER_SCRIPT       (CAN_MAX_VALUE_CODE_FCT - 2)    // data[0] : numéro du script
+#define FCT_ENVOYER_SCRIPT      (CAN_MAX_VALUE_CODE_FCT - 1)    // Trame d'envoi de la page de scripts
+#define FCT_EVENEMENT_SCRIPT    CAN_MAX_VALUE_CODE_FCT          // data[0] : événements (PWM_OP_EVENT)
 
-void configure_CAN(CAN_HandleTypeDef *hcan, CAN_EMIT_ADDR adresse);
+// Un code fonction doit tenir dans son champ de l'identifiant et ne pas reprendre un code de CAN_FCT_CODE
+#define CAN_FCT_VALID(code)     (((code) & ~CAN_FILTER_CODE_FCT) == 0 && (code) <= CAN_MAX_VALUE_CODE_FCT)
+#define CAN_FCT_FREE(code)      ((code) != FCT_OUVRIR_PANIER && (code) != FCT_FERMER_PANIER && \
+                                 (code) != FCT_ASPIRER_BALLE && (code) != FCT_PLACER_BALLE)
+
+_Static_assert(CAN_FCT_VALID(FCT_LANCER_SCRIPT) && CAN_FCT_FREE(FCT_LANCER_SCRIPT), "FCT_LANCER_SCRIPT invalide");
+_Static_assert(CAN_FCT_VALID(FCT_ENVOYER_SCRIPT) && CAN_FCT_FREE(FCT_ENVOYER_SCRIPT), "FCT_ENVOYER_SCRIPT invalide");
+_Static_assert(CAN_FCT_VALID(FCT_EVENEMENT_SCRIPT) && CAN_FCT_FREE(FCT_EVENEMENT_SCRIPT), "FCT_EVENEMENT_SCRIPT invalide");
+
+// Codes fonction urgents, reçus dans la FIFO1 et traités directement dans l'interruption
+#define FCT_ARRET_URGENCE       (CAN_MAX_VALUE_CODE_FCT - 4)    // Tous les actionneurs à 0, verrouillé
+#define FCT_COUPER_TURBINE      (CAN_MAX_VALUE_CODE_FCT - 3)    // Turbine à 0
+
+// Les filtres de la FIFO1 retirent ces codes de la FIFO0 : ils ne doivent reprendre aucun autre code
+_Static_assert(CAN_FCT_VALID(FCT_ARRET_URGENCE) && CAN_FCT_FREE(FCT_ARRET_URGENCE), "FCT_ARRET_URGENCE invalide");
+_Static_assert(CAN_FCT_VALID(FCT_COUPER_TURBINE) && CAN_FCT_FREE(FCT_COUPER_TURBINE), "FCT_COUPER_TURBINE invalide");
+
+// Fin de l'arrêt d'urgence, reçue dans la FIFO0 : les commandes envoyées avant elle restent refusées
+#define FCT_REPRISE_URGENCE     (CAN_MAX_VALUE_CODE_FCT - 5)    // Séquences et scripts arrêtés, valeurs acceptées
+
+_Static_assert(CAN_FCT_VALID(FCT_REPRISE_URGENCE) && CAN_FCT_FREE(FCT_REPRISE_URGENCE), "FCT_REPRISE_URGENCE invalide");
+
+// Scripts qui remplacent les actions codées en dur quand la page les contient
+#define SCRIPT_OUVRIR_PANIER    0
+#define SCRIPT_FERMER_PANIER    1
+#define SCRIPT_ASPIRER_BALLE    2
+#define SCRIPT_PLACER_BALLE     3
+
+#define CAN_RX_RING_SIZE        16      // Trames en attente de dispatch_CAN (puissance de 2)
+#define CAN_DISPATCH_BATCH      8       // Trames traitées par passage de la boucle principale
+
+// Trame brute, copiée telle quelle par l'interruption
+
+typedef struct {
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+} CAN_RawFrame;
+
+extern volatile uint32_t can_rx_dropped;
+
+
+HAL_StatusTypeDef configure_CAN(CAN_HandleTypeDef *hcan, CAN_EMIT_ADDR adresse);
+int dispatch_CAN(uint8_t max);
 int format_frame(can_mess_t *msg, CAN_RxHeaderTypeDef frame, const uint8_t data[]);
 int send(CAN_HandleTypeDef *hcan, CAN_ADDR addr, CAN_FCT_CODE fct_code , uint8_t data[], uint8_t data_len, bool is_rep, uint8_t rep_len, uint8_t msg_id);
 
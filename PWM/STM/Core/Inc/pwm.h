@@ -12,16 +12,20 @@
 #include "stm32l432xx.h"
 #include "stm32l4xx_hal.h"
 
-#define SERVO_MIN                   205
-#define SERVO_90                    410
-#define SERVO_MAX                   615
-#define SERVO_BASKET_CHANNEL        2
-#define SERVO_BALL_CHANNEL          3
-#define TURBINE_CHANNEL             1
+#define SERVO_MIN_US                974     // Largeurs d'impulsion (µs), converties avec le PSC courant
+#define SERVO_90_US                 1948
+#define SERVO_MAX_US                2921
+#define SERVO_BASKET_CHANNEL        PWM_SERVO_BASKET
+#define SERVO_BALL_CHANNEL          PWM_SERVO_BALL
+#define TURBINE_CHANNEL             PWM_TURBINE
 
 #define PWM_MIN                     0
-#define PWM_MAX                     4095
+#define PWM_MAX                     4095    // ARR de MX_TIM1_Init, la limite réelle suit PWM_configure
 #define PWM_ON_CYCLE                0.7f
+#define PWM_Q15_ONE                 0x8000  // Cycle de travail Q15 de 1.0
+#define PWM_ON_Q15                  ((uint16_t) (PWM_ON_CYCLE * PWM_Q15_ONE))
+#define PWM_FRAME_SIZE              4       // CCR1 à CCR4, chargés ensemble par DMA burst
+#define PWM_SOLVER_STEPS            256     // Prescalers essayés par PWM_configure
 
 #define PWM_ERR_START               0x01
 #define PWM_ERR_STOP                0x02
@@ -29,13 +33,49 @@
 #define PWM_ERR_COUNT_TOO_HIGH      0x04
 #define PWM_ERR_DUTY_CYCLE_TOO_LOW  0x05
 #define PWM_ERR_DUTY_CYCLE_TOO_HIGH 0x06
+#define PWM_ERR_CHANNEL             0x07
+#define PWM_ERR_DMA                 0x08
+#define PWM_ERR_FREQUENCY           0x09
+#define PWM_ERR_EMERGENCY           0x0A
 
-int PWM_start_timer(uint32_t channel);
-int PWM_stop_timer(uint32_t channel);
+// Actionneurs (une ligne par actionneur dans la table channels de pwm.c)
 
-int PWM_on(uint32_t channel);
-int PWM_off(uint32_t channel);
-int PWM_set_count(uint32_t channel, uint16_t count);
-int PWM_set_cycle(uint32_t channel, float duty_cycle);
+typedef enum {
+    PWM_TURBINE = 0,
+    PWM_SERVO_BASKET,
+    PWM_SERVO_BALL,
+    PWM_CHANNEL_COUNT
+} PWM_Id;
+
+// Sortie PWM d'un actionneur
+
+typedef struct {
+    TIM_HandleTypeDef *timer;       // Timer qui génère le signal
+    uint32_t channel;               // TIM_CHANNEL_x du timer
+    volatile uint32_t *ccr;         // Registre CCRx, ou sa case du frame DMA burst de TIM1
+    uint8_t burst;                  // Valeur envoyée par PWM_commit (frame de TIM1)
+    uint8_t complementary;          // Sortie complémentaire CHxN
+} PWM_Channel;
+
+int PWM_configure(TIM_HandleTypeDef *timer, uint32_t target_hz, uint32_t min_resolution);
+int PWM_start_timer(PWM_Id id);
+int PWM_stop_timer(PWM_Id id);
+
+int PWM_on(PWM_Id id);
+int PWM_off(PWM_Id id);
+int PWM_set_count(PWM_Id id, uint16_t count);
+int PWM_set_cycle(PWM_Id id, float duty_cycle);
+int PWM_set_q15(PWM_Id id, uint16_t duty);
+int PWM_set_us(PWM_Id id, uint16_t us);
+uint16_t PWM_get_count(PWM_Id id);
+
+int PWM_force_off(PWM_Id id);
+void PWM_emergency_stop(void);
+void PWM_emergency_clear(void);
+
+int PWM_stage_count(PWM_Id id, uint16_t count);
+int PWM_stage_q15(PWM_Id id, uint16_t duty);
+int PWM_stage_us(PWM_Id id, uint16_t us);
+int PWM_commit(void);
 
 #endif //TURBINE_PWM_H
@@ -0,0 +1,72 @@
+/*!
+ *  @version 1.0
+ *  @file    pwm_script.h
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Fichier d'entête de l'interpréteur de scripts d'actionneurs stockés en flash
+ */
+
+#ifndef PWM_SCRIPT_H
+#define PWM_SCRIPT_H
+
+#include "pwm.h"
+
+#define PWM_SCRIPT_ADDR             0x0803F800  // Dernière page de flash (réservée dans STM32L432KCUX_FLASH.ld)
+#define PWM_SCRIPT_PAGE_SIZE        2048
+#define PWM_SCRIPT_MAGIC            0x50574D53  // Marque d'une page de scripts valide
+#define PWM_SCRIPT_MAX              16          // Scripts dans la page
+#define PWM_SCRIPT_RUNNERS          4           // Scripts exécutés en même temps
+#define PWM_SCRIPT_BUDGET           32          // Instructions max par script et par appel de PWM_script_run
+#define PWM_SCRIPT_NONE             0xFFFF      // Script absent de la page
+
+#define PWM_ERR_SCRIPT_INVALID      0x20
+#define PWM_ERR_SCRIPT_ABSENT       0x21
+#define PWM_ERR_SCRIPT_UPLOAD       0x22
+#define PWM_ERR_SCRIPT_FLASH        0x23
+#define PWM_ERR_SCRIPT_BUSY         0x24
+
+// Opcodes (valeurs sur 16 bits en little endian)
+
+typedef enum {
+    PWM_OP_END = 0x00,              // Fin du script
+    PWM_OP_SET,                     // id, count16 : valeur du compteur d'un actionneur
+    PWM_OP_RAMP,                    // id, count16, ms16 : rampe linéaire jusqu'à count en ms
+    PWM_OP_WAIT,                    // ms16 : attente
+    PWM_OP_EVENT,                   // mask8 : attente d'un des événements (PWM_script_event)
+    PWM_OP_LOOP                     // offset16, n8 : retour à offset, n passages (0 : sans fin)
+} PWM_Opcode;
+
+// Entête de la page, suivi du bytecode
+
+typedef struct {
+    uint32_t magic;                 // PWM_SCRIPT_MAGIC si la page est valide
+    uint16_t size;                  // Octets de bytecode après l'entête
+    uint16_t checksum;              // Somme des octets de bytecode
+    uint16_t offset[PWM_SCRIPT_MAX];// Début de chaque script dans le bytecode (PWM_SCRIPT_NONE si absent)
+} PWM_ScriptHeader;
+
+// Script en cours d'exécution
+
+typedef struct {
+    uint16_t pc;                    // Prochaine instruction (position dans le bytecode)
+    uint16_t base;                  // Début du script (les offsets de PWM_OP_LOOP y sont relatifs)
+    uint8_t state;                  // Exécution, attente, rampe, événement
+    uint8_t script;
+    uint8_t event_mask;
+    uint8_t loop_left;              // Passages restants de la boucle en cours (une seule boucle)
+    uint32_t start;                 // HAL_GetTick() de début de l'attente ou de la rampe
+    uint16_t duration;              // Durée de l'attente ou de la rampe (ms)
+    uint16_t ramp_from;
+    uint16_t ramp_to;
+    uint8_t ramp_id;
+} PWM_ScriptRunner;
+
+int PWM_script_init(void);
+int PWM_script_start(uint8_t script);
+void PWM_script_stop(uint8_t script);
+void PWM_script_event(uint8_t mask);
+void PWM_script_run(void);
+
+int PWM_script_upload(const uint8_t data[], uint8_t len);
+
+#endif //PWM_SCRIPT_H
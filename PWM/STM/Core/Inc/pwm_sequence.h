@@ -0,0 +1,56 @@
+/*!
+ *  @version 1.0
+ *  @file    pwm_sequence.h
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Fichier d'entête du séquenceur d'actionneurs (étapes temporisées sans HAL_Delay)
+ */
+
+#ifndef PWM_SEQUENCE_H
+#define PWM_SEQUENCE_H
+
+#include "pwm.h"
+
+#define PWM_SEQ_SLOTS               4       // Séquences exécutées en même temps
+
+#define PWM_ERR_SEQ_FULL            0x10
+#define PWM_ERR_SEQ_EMPTY           0x11
+
+// Écriture des étapes dans une table : PWM_STEP_US(PWM_SERVO_BALL, SERVO_MAX_US), PWM_STEP_WAIT(1000), ...
+
+#define PWM_STEP_COUNT(id, count)   {PWM_STEP_SET_COUNT, (id), (count)}
+#define PWM_STEP_Q15(id, duty)      {PWM_STEP_SET_Q15, (id), (duty)}
+#define PWM_STEP_US(id, us)         {PWM_STEP_SET_US, (id), (us)}
+#define PWM_STEP_WAIT(ms)           {PWM_STEP_DELAY, 0, (ms)}
+
+typedef enum {
+    PWM_STEP_SET_COUNT = 0,         // Valeur du compteur d'un actionneur
+    PWM_STEP_SET_Q15,               // Cycle de travail Q15 d'un actionneur
+    PWM_STEP_SET_US,                // Largeur d'impulsion (µs) d'un actionneur
+    PWM_STEP_DELAY                  // Attente en millisecondes
+} PWM_StepType;
+
+// Étape d'une séquence
+
+typedef struct {
+    uint8_t type;                   // PWM_StepType
+    uint8_t id;                     // Actionneur (PWM_Id), ignoré pour une attente
+    uint16_t value;                 // Compteur, cycle Q15, largeur (µs) ou durée (ms)
+} PWM_Step;
+
+// Séquence en cours d'exécution
+
+typedef struct {
+    const PWM_Step *steps;
+    uint8_t length;
+    uint8_t index;                  // Prochaine étape
+    uint16_t wait_ms;               // Attente restante avant la prochaine étape
+    volatile uint8_t active;
+} PWM_Sequence;
+
+int PWM_sequence_start(const PWM_Step steps[], uint8_t length);
+void PWM_sequence_stop(const PWM_Step steps[]);
+int PWM_sequence_busy(const PWM_Step steps[]);
+void PWM_sequence_tick(void);
+
+#endif //PWM_SEQUENCE_H
@@ -8,59 +8,211 @@
 
 #include "can.h"
 #include "pwm.h"
+#include "pwm_sequence.h"
+#include "pwm_script.h"
 
 
 CAN_EMIT_ADDR can_addr;
 
-void configure_CAN(CAN_HandleTypeDef *hcan, CAN_EMIT_ADDR addr) {
+// Champ de l'adresse du récepteur dans un filtre 16 bits, et sa valeur en broadcast
+#define CAN_FILTER_DEST         0b111100000000000
+#define CAN_FILTER_BROADCAST    0b111100000000000
+
+// File des trames reçues : écrite par l'interruption (head), lue par la boucle principale (tail)
+static CAN_RawFrame rx_ring[CAN_RX_RING_SIZE];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+volatile uint32_t can_rx_dropped = 0;   // Trames perdues, file pleine
+
+// Séquences lancées par les codes fonction, exécutées par PWM_sequence_tick
+static const PWM_Step aspirer_balle[] = {
+    PWM_STEP_Q15(TURBINE_CHANNEL, PWM_ON_Q15),
+    PWM_STEP_WAIT(1000),
+    PWM_STEP_Q15(TURBINE_CHANNEL, 0),
+};
+
+static const PWM_Step placer_balle[] = {
+    PWM_STEP_US(SERVO_BALL_CHANNEL, SERVO_MAX_US),
+    PWM_STEP_WAIT(1000),
+    PWM_STEP_US(SERVO_BALL_CHANNEL, SERVO_MIN_US),
+};
+
+/*!
+ *  @brief Envoyer un code fonction adressé à cette carte dans la FIFO1
+ *  @param hcan Le CAN à configurer
+ *  @param bank La banque de filtre
+ *  @param fct_code Le code fonction urgent
+ *  @param dest L'adresse acceptée, au format des filtres 16 bits de la banque 0
+ *  @return Le statut HAL de la configuration
+ */
+static HAL_StatusTypeDef configure_urgent_filter(CAN_HandleTypeDef *hcan, uint32_t bank, uint32_t fct_code, uint16_t dest) {
+    CAN_FilterTypeDef sFilterConfig;
+
+    // Registres 32 bits : EXTID décalé de 3 bits, suivi de IDE et RTR. Un filtre 16 bits
+    // correspond aux 16 bits de poids fort, l'adresse est donc placée comme dans la banque 0
+    uint32_t id = ((uint32_t) dest << 16) | (fct_code << 3) | CAN_ID_EXT;
+    uint32_t mask = ((uint32_t) CAN_FILTER_DEST << 16) | ((uint32_t) CAN_FILTER_CODE_FCT << 3) | CAN_ID_EXT;
+
+    sFilterConfig.FilterMode =           CAN_FILTERMODE_IDMASK;
+    sFilterConfig.FilterScale =          CAN_FILTERSCALE_32BIT;
+    sFilterConfig.FilterFIFOAssignment = CAN_RX_FIFO1;
+    sFilterConfig.SlaveStartFilterBank = 14;
+    sFilterConfig.FilterActivation =     ENABLE;
+    sFilterConfig.FilterBank =           bank;
+    sFilterConfig.FilterIdHigh =         id >> 16;
+    sFilterConfig.FilterIdLow =          id & 0xFFFF;
+    sFilterConfig.FilterMaskIdHigh =     mask >> 16;
+    sFilterConfig.FilterMaskIdLow =      mask & 0xFFFF;
+
+    return HAL_CAN_ConfigFilter(hcan, &sFilterConfig);
+}
+
+
+/*!
+ *  @brief Configurer les filtres et démarrer le CAN
+ *  @param hcan Le CAN à configurer
+ *  @param addr L'adresse de cette carte
+ *  @return Le statut HAL du premier filtre en erreur, ou du démarrage
+ */
+HAL_StatusTypeDef configure_CAN(CAN_HandleTypeDef *hcan, CAN_EMIT_ADDR addr) {
     CAN_FilterTypeDef sFilterConfig;
+    HAL_StatusTypeDef status;
 
     sFilterConfig.FilterMode =           CAN_FILTERMODE_IDMASK; // Filtrage par liste ou par masque
     sFilterConfig.FilterScale =          CAN_FILTERSCALE_16BIT; // Filtre de 32 bits ou 1 de 16 bits
     sFilterConfig.FilterFIFOAssignment = CAN_RX_FIFO0;          // 3 files avec 3 filtres par file
     sFilterConfig.SlaveStartFilterBank = 14;                    // Choix du filtre dans la banque
     sFilterConfig.FilterActivation =     ENABLE;
-    sFilterConfig.FilterMaskIdLow =      0b111100000000000;     // Masque LSBs
-    sFilterConfig.FilterMaskIdHigh =     0b111100000000000;     // Masque MSBs
+    sFilterConfig.FilterMaskIdLow =      CAN_FILTER_DEST;       // Masque LSBs
+    sFilterConfig.FilterMaskIdHigh =     CAN_FILTER_DEST;       // Masque MSBs
 
     sFilterConfig.FilterBank =           0;
     sFilterConfig.FilterIdHigh =         addr >> 9;             // Adresse de l'émetteur
-    sFilterConfig.FilterIdLow =          0b111100000000000;     // Adresse de broadcast
+    sFilterConfig.FilterIdLow =          CAN_FILTER_BROADCAST;  // Adresse de broadcast
+
+    status = HAL_CAN_ConfigFilter(hcan, &sFilterConfig);
+    if (status != HAL_OK) return status;
 
-    HAL_CAN_ConfigFilter(hcan, &sFilterConfig);
+    // Les filtres 32 bits sont prioritaires : les codes urgents adressés à cette carte
+    // ou en broadcast vont dans la FIFO1 (un filtre par adresse)
+    const uint32_t urgent[] = {FCT_ARRET_URGENCE, FCT_COUPER_TURBINE};
+    const uint16_t dest[] = {addr >> 9, CAN_FILTER_BROADCAST};
+    uint32_t bank = 1;
+
+    for (uint8_t i = 0; i < sizeof(urgent) / sizeof(urgent[0]); i++) {
+        for (uint8_t j = 0; j < sizeof(dest) / sizeof(dest[0]); j++) {
+            status = configure_urgent_filter(hcan, bank++, urgent[i], dest[j]);
+            if (status != HAL_OK) return status;
+        }
+    }
 
     can_addr = addr;
-    HAL_CAN_Start(hcan);                                             // Démarrer le périphérique CAN
+    status = HAL_CAN_Start(hcan);                                    // Démarrer le périphérique CAN
+    if (status != HAL_OK) return status;
+
     HAL_CAN_ActivateNotification(hcan, CAN_IT_RX_FIFO0_MSG_PENDING); // Activer le mode interruption
+    return HAL_CAN_ActivateNotification(hcan, CAN_IT_RX_FIFO1_MSG_PENDING); // Codes urgents
 }
 
 
+/*!
+ *  @brief Arrêts urgents reçus dans la FIFO1 (appelée par CAN1_RX1_IRQHandler)
+ *  @param hcan Le CAN qui a reçu les trames
+ *
+ *  Priorité d'interruption au-dessus de la FIFO0 : les registres de compare sont
+ *  écrits directement, sans passer par la file de dispatch_CAN
+ */
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan) {
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+
+    while (HAL_CAN_GetRxFifoFillLevel(hcan, CAN_RX_FIFO1) > 0) {
+        if (HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO1, &header, data) != HAL_OK)
+            break;
+
+        switch (header.ExtId & CAN_FILTER_CODE_FCT) {
+            case FCT_ARRET_URGENCE:
+                PWM_emergency_stop();
+                break;
+            case FCT_COUPER_TURBINE:
+                PWM_force_off(TURBINE_CHANNEL);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+/*!
+ *  @brief Vider la FIFO0 du CAN dans la file des trames reçues (appelée par le HAL)
+ *  @param hcan Le CAN qui a reçu les trames
+ *
+ *  Seulement la lecture des registres : le décodage et les actions sont faits
+ *  par dispatch_CAN dans la boucle principale
+ */
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
-    uint8_t RxData[8];
-    CAN_RxHeaderTypeDef RxHeader;
-    HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &RxHeader, RxData);
+    while (HAL_CAN_GetRxFifoFillLevel(hcan, CAN_RX_FIFO0) > 0) {
+        uint8_t head = rx_head;
+        uint8_t next = (head + 1) & (CAN_RX_RING_SIZE - 1);
+        CAN_RawFrame *frame = &rx_ring[head];
+
+        // La trame est lue même si la file est pleine pour libérer la FIFO matérielle
+        if (HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &frame->header, frame->data) != HAL_OK)
+            break;
+
+        if (next == rx_tail) {
+            can_rx_dropped++;
+            continue;
+        }
 
-    can_mess_t msg;
-    int status = format_frame(&msg, RxHeader, RxData);
+        __DMB();            // Trame écrite avant de la publier
+        rx_head = next;
+    }
+}
 
-    if (status != 0)
-        return;
 
-    switch (msg.fct_code) {
+/*!
+ *  @brief Exécuter un message reçu
+ *  @param msg Le message décodé
+ */
+static void execute_CAN(const can_mess_t *msg) {
+    // Le script de la page flash est prioritaire sur l'action codée en dur
+    switch (msg->fct_code) {
         case FCT_OUVRIR_PANIER:
-            PWM_set_count(SERVO_BASKET_CHANNEL, SERVO_90);
+            if (PWM_script_start(SCRIPT_OUVRIR_PANIER) != 0)
+                PWM_set_us(SERVO_BASKET_CHANNEL, SERVO_90_US);
             break;
         case FCT_FERMER_PANIER:
-            PWM_set_count(SERVO_BASKET_CHANNEL, SERVO_MIN);
+            if (PWM_script_start(SCRIPT_FERMER_PANIER) != 0)
+                PWM_set_us(SERVO_BASKET_CHANNEL, SERVO_MIN_US);
             break;
         case FCT_ASPIRER_BALLE:
-            PWM_on(TURBINE_CHANNEL);
-            HAL_Delay(1000);
-            PWM_off(TURBINE_CHANNEL);
+            if (PWM_script_start(SCRIPT_ASPIRER_BALLE) != 0)
+                PWM_sequence_start(aspirer_balle, sizeof(aspirer_balle) / sizeof(PWM_Step));
+            break;
         case FCT_PLACER_BALLE:
-            PWM_set_count(SERVO_BALL_CHANNEL, SERVO_MAX);
-            HAL_Delay(1000);
-            PWM_set_count(SERVO_BALL_CHANNEL, SERVO_MIN);
+            if (PWM_script_start(SCRIPT_PLACER_BALLE) != 0)
+                PWM_sequence_start(placer_balle, sizeof(placer_balle) / sizeof(PWM_Step));
+            break;
+        case FCT_LANCER_SCRIPT:
+            if (msg->data_len >= 1)
+                PWM_script_start(msg->data[0]);
+            break;
+        case FCT_ENVOYER_SCRIPT:
+            PWM_script_upload(msg->data, msg->data_len);
+            break;
+        case FCT_EVENEMENT_SCRIPT:
+            if (msg->data_len >= 1)
+                PWM_script_event(msg->data[0]);
+            break;
+        case FCT_REPRISE_URGENCE:
+            // Les séquences et scripts interrompus par l'arrêt ne reprennent pas au milieu
+            PWM_sequence_stop(aspirer_balle);
+            PWM_sequence_stop(placer_balle);
+            for (uint8_t i = 0; i < PWM_SCRIPT_MAX; i++)
+                PWM_script_stop(i);
+            PWM_emergency_clear();
             break;
         default:
             break;
@@ -68,6 +220,32 @@ void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
 }
 
 
+/*!
+ *  @brief Décoder et exécuter les trames reçues par l'interruption
+ *  @param max Le nombre maximal de trames traitées (0 : toutes)
+ *  @return Le nombre de trames traitées
+ *  @note A appeler dans la boucle principale
+ */
+int dispatch_CAN(uint8_t max) {
+    int count = 0;
+
+    while (rx_tail != rx_head && (max == 0 || count < max)) {
+        uint8_t tail = rx_tail;
+        __DMB();            // Trame lue après avoir vu rx_head
+
+        can_mess_t msg;
+        if (format_frame(&msg, rx_ring[tail].header, rx_ring[tail].data) == 0)
+            execute_CAN(&msg);
+
+        __DMB();            // Trame lue avant de libérer sa case
+        rx_tail = (tail + 1) & (CAN_RX_RING_SIZE - 1);
+        count++;
+    }
+
+    return count;
+}
+
+
 int format_frame(can_mess_t *rep, CAN_RxHeaderTypeDef frame, const uint8_t data[]){
     rep->recv_addr = (frame.ExtId & CAN_FILTER_ADDR_EMETTEUR);
     rep->emit_addr = (frame.ExtId & CAN_FILTER_ADDR_RECEPTEUR);
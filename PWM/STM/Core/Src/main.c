@@ -23,6 +23,7 @@
 /* USER CODE BEGIN Includes */
 #include "pwm.h"
 #include "can.h"
+#include "pwm_script.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -94,10 +95,12 @@ int main(void)
   MX_TIM1_Init();
   MX_CAN1_Init();
   /* USER CODE BEGIN 2 */
-  configure_CAN(&hcan1, CAN_ADDR_ACTIONNEUR_E);
+  if (configure_CAN(&hcan1, CAN_ADDR_ACTIONNEUR_E) != HAL_OK)
+    Error_Handler();
   PWM_start_timer(TURBINE_CHANNEL);
   PWM_start_timer(SERVO_BALL_CHANNEL);
   PWM_start_timer(SERVO_BASKET_CHANNEL);
+  PWM_script_init();
 
   /* USER CODE END 2 */
 
@@ -108,6 +111,8 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    dispatch_CAN(CAN_DISPATCH_BATCH);
+    PWM_script_run();
   }
   /* USER CODE END 3 */
 }
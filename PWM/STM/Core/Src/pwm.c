@@ -6,17 +6,194 @@
  *  @brief   Code source de la librairie PWM STM32
  */
 
+#include <string.h>
 #include "pwm.h"
 extern TIM_HandleTypeDef htim1;
 
+// Valeurs de CCR1 à CCR4 : modifiées par PWM_stage_count, envoyées par PWM_commit
+static uint32_t frame[PWM_FRAME_SIZE];
+static uint32_t dma_frame[PWM_FRAME_SIZE];  // Copie lue par le DMA pendant le burst
+static volatile uint8_t frame_busy = 0;     // Burst en attente du prochain update event
+static volatile uint8_t frame_pending = 0;  // Frame modifié pendant un burst
+static volatile uint8_t emergency = 0;      // Arrêt d'urgence en cours, plus aucune valeur acceptée
+
+// Sortie de chaque actionneur : ajouter une sortie (TIM2, TIM15, TIM16...) revient à ajouter une ligne
+static const PWM_Channel channels[PWM_CHANNEL_COUNT] = {
+    [PWM_TURBINE]      = {&htim1, TIM_CHANNEL_1, &frame[0], 1, 1},  // PA7  (TIM1_CH1N)
+    [PWM_SERVO_BASKET] = {&htim1, TIM_CHANNEL_2, &frame[1], 1, 0},  // PA9  (TIM1_CH2)
+    [PWM_SERVO_BALL]   = {&htim1, TIM_CHANNEL_3, &frame[2], 1, 0},  // PA10 (TIM1_CH3)
+};
+
+
+/*!
+ *  @brief Lancer le burst DMA qui charge CCR1 à CCR4 au prochain update event
+ *  @return Code d'erreur
+ *  @note A appeler avec les interruptions désactivées ou depuis le callback DMA
+ *
+ *  Pendant un arrêt d'urgence, le frame envoyé est mis à 0 : un burst en attente
+ *  ne peut pas rallumer une sortie
+ */
+static int PWM_frame_start(void) {
+    if (emergency)
+        memset(frame, 0, sizeof(frame));
+
+    memcpy(dma_frame, frame, sizeof(frame));
+
+    if (HAL_TIM_DMABurst_WriteStart(&htim1, TIM_DMABASE_CCR1, TIM_DMA_UPDATE,
+                                    dma_frame, TIM_DMABURSTLENGTH_4TRANSFERS) != HAL_OK)
+        return PWM_ERR_DMA;
+
+    frame_busy = 1;
+    return 0;
+}
+
+
+/*!
+ *  @brief Fin du burst DMA (appelée par le HAL), lance le frame suivant s'il a été modifié
+ *  @param htim Le timer dont le burst est terminé
+ */
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
+    if (htim->Instance != TIM1)
+        return;
+
+    HAL_TIM_DMABurst_WriteStop(htim, TIM_DMA_UPDATE);
+    frame_busy = 0;
+
+    if (frame_pending) {
+        frame_pending = 0;
+        PWM_frame_start();
+    }
+}
+
+
+/*!
+ *  @brief Fréquence d'horloge d'un timer
+ *  @param instance Le timer (TIM1, TIM2, ...)
+ *  @return La fréquence en Hz
+ *
+ *  TIM1, TIM15 et TIM16 sont sur APB2, les autres sur APB1. Si le prescaler
+ *  APB n'est pas 1, l'horloge des timers est le double de PCLK
+ */
+static uint32_t PWM_timer_clock(TIM_TypeDef *instance) {
+    if (instance == TIM1 || instance == TIM15 || instance == TIM16) {
+        uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+        return (RCC->CFGR & RCC_CFGR_PPRE2_2) ? 2*pclk : pclk;
+    }
+
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    return (RCC->CFGR & RCC_CFGR_PPRE1_2) ? 2*pclk : pclk;
+}
+
+
+/*!
+ *  @brief Chercher le couple PSC/ARR le plus proche d'une fréquence
+ *  @param clock Fréquence d'horloge du timer (Hz)
+ *  @param target_hz Fréquence PWM voulue (Hz)
+ *  @param min_resolution Nombre minimal de pas par période (ARR + 1)
+ *  @param psc Le prescaler trouvé
+ *  @param arr L'auto-reload trouvé
+ *  @return 0 si un couple existe, -1 sinon
+ *
+ *  f = clock / ((PSC + 1)(ARR + 1)). On part du plus petit prescaler (meilleure
+ *  résolution) et on garde le couple d'erreur minimale parmi les PWM_SOLVER_STEPS
+ *  suivants, tant que la résolution reste suffisante. Calcul entier uniquement
+ */
+static int PWM_solve(uint32_t clock, uint32_t target_hz, uint32_t min_resolution,
+                     uint32_t *psc, uint32_t *arr) {
+    if (target_hz == 0 || min_resolution < 2) return -1;
+
+    uint64_t ticks = ((uint64_t) clock + target_hz/2) / target_hz;  // (PSC + 1)(ARR + 1) idéal
+    uint64_t best_err = UINT64_MAX;
+
+    uint32_t first = (uint32_t) ((ticks + 0xFFFF) / 0x10000);  // ARR + 1 <= 65536
+    if (first == 0) first = 1;
+
+    for (uint32_t div = first; div <= 0x10000 && div < first + PWM_SOLVER_STEPS; div++) {
+        uint64_t step = (uint64_t) div * target_hz;
+        uint64_t period = ((uint64_t) clock + step/2) / step;
+
+        if (period > 0x10000) continue;
+        if (period < min_resolution) break;
+
+        uint64_t real = period * step;
+        uint64_t err = real > clock ? real - clock : clock - real;
+
+        if (err < best_err) {
+            best_err = err;
+            *psc = div - 1;
+            *arr = (uint32_t) period - 1;
+            if (err == 0) break;
+        }
+    }
+
+    return best_err == UINT64_MAX ? -1 : 0;
+}
+
+
+/*!
+ *  @brief Changer la fréquence PWM d'un timer
+ *  @param timer Le timer (&htim1, ...)
+ *  @param target_hz Fréquence PWM voulue (Hz)
+ *  @param min_resolution Nombre minimal de pas par période (ex : 1000)
+ *  @return Code d'erreur
+ *
+ *  PSC, ARR et les CCR sont préchargés : ils changent tous ensemble au prochain
+ *  update event, sans période coupée. Les valeurs des actionneurs du timer sont
+ *  remises à l'échelle pour garder le même cycle de travail
+ */
+int PWM_configure(TIM_HandleTypeDef *timer, uint32_t target_hz, uint32_t min_resolution) {
+    uint32_t psc, arr;
+    if (PWM_solve(PWM_timer_clock(timer->Instance), target_hz, min_resolution, &psc, &arr) != 0)
+        return PWM_ERR_FREQUENCY;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // Un burst en attente écrirait les anciennes valeurs après le changement
+    if (timer == &htim1 && frame_busy) {
+        HAL_TIM_DMABurst_WriteStop(&htim1, TIM_DMA_UPDATE);
+        frame_busy = 0;
+        frame_pending = 0;
+    }
+
+    uint32_t old_period = timer->Instance->ARR + 1;
+    timer->Instance->PSC = psc;
+    timer->Instance->ARR = arr;
+    timer->Init.Prescaler = psc;
+    timer->Init.Period = arr;
+
+    for (uint8_t i = 0; i < PWM_CHANNEL_COUNT; i++) {
+        const PWM_Channel *c = &channels[i];
+        if (c->timer != timer)
+            continue;
+
+        uint32_t count = (uint32_t) (((uint64_t) *c->ccr * (arr + 1) + old_period/2) / old_period);
+        if (count > arr) count = arr;
+
+        *c->ccr = count;
+        if (c->burst)
+            __HAL_TIM_SET_COMPARE(timer, c->channel, count);
+    }
+
+    __set_PRIMASK(primask);
+    return 0;
+}
+
 
 /*!
  *  @brief Démarrer le timer pour générer le PWM
- *  @param i2c Généralement &htim1 (structure d'STM du timer configuré)
+ *  @param id L'actionneur (PWM_TURBINE, ...)
  *  @return Code d'erreur
  */
-int PWM_start_timer(uint32_t channel) {
-    if (HAL_TIM_PWM_Start(&htim1, channel) != HAL_OK)
+int PWM_start_timer(PWM_Id id) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+
+    const PWM_Channel *c = &channels[id];
+    HAL_StatusTypeDef status = c->complementary
+        ? HAL_TIMEx_PWMN_Start(c->timer, c->channel)
+        : HAL_TIM_PWM_Start(c->timer, c->channel);
+
+    if (status != HAL_OK)
         return PWM_ERR_START;
 
     return 0;
@@ -25,11 +202,18 @@ int PWM_start_timer(uint32_t channel) {
 
 /*!
  *  @brief Arrêter le timer qui génère le PWM
- *  @param i2c Généralement &htim1 (structure d'STM du timer configuré)
+ *  @param id L'actionneur (PWM_TURBINE, ...)
  *  @return Code d'erreur
  */
-int PWM_stop_timer(uint32_t channel) {
-    if (HAL_TIM_PWM_Stop(&htim1, channel) != HAL_OK)
+int PWM_stop_timer(PWM_Id id) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+
+    const PWM_Channel *c = &channels[id];
+    HAL_StatusTypeDef status = c->complementary
+        ? HAL_TIMEx_PWMN_Stop(c->timer, c->channel)
+        : HAL_TIM_PWM_Stop(c->timer, c->channel);
+
+    if (status != HAL_OK)
         return PWM_ERR_STOP;
 
     return 0;
@@ -38,54 +222,280 @@ int PWM_stop_timer(uint32_t channel) {
 
 /*!
  * @brief Activer la turbine (cycle de travail à PWM_ON_CYCLE)
- *  @param timer Généralement &htim1 (structure d'STM du timer configuré)
+ *  @param id L'actionneur (PWM_TURBINE, ...)
  *  @return Code d'erreur
  */
-int PWM_on(uint32_t channel) {
-    return PWM_set_cycle(channel, PWM_ON_CYCLE);
+int PWM_on(PWM_Id id) {
+    return PWM_set_q15(id, PWM_ON_Q15);
 }
 
 
 /*!
- * @brief Désactiver la turbine (cycle de travail à EDF30_OFF_CYCLE)
- * @param timer Généralement &htim1 (structure d'STM du timer configuré)
- * @return
+ * @brief Désactiver la turbine (cycle de travail à 0)
+ * @param id L'actionneur (PWM_TURBINE, ...)
+ * @return Code d'erreur
  */
-int PWM_off(uint32_t channel) {
-    return PWM_set_cycle(channel, 0);
+int PWM_off(PWM_Id id) {
+    return PWM_set_q15(id, 0);
 }
 
 
 /*!
- *  @brief Définir directement le cycle de travail du PWM
- *  @param timer Généralement &htim1 (structure d'STM du timer configuré)
- *  @param count Valeur du compteur (0 à PWM_MAX)
+ *  @brief Écrire la valeur d'un actionneur dans le frame (ou son CCR) hors arrêt d'urgence
+ *  @param id L'actionneur (déjà vérifié)
+ *  @param count Valeur du compteur (déjà vérifiée)
  *  @return Code d'erreur
+ *
+ *  Le test et l'écriture sont faits interruptions masquées : un arrêt d'urgence reçu
+ *  entre les deux ne peut pas être écrasé par l'ancienne valeur
  */
-int PWM_set_count(uint32_t channel, uint16_t count) {
-    if (count < PWM_MIN) return PWM_ERR_COUNT_TOO_LOW;
-    if (count > PWM_MAX) return PWM_ERR_COUNT_TOO_HIGH;
+static int PWM_stage(PWM_Id id, uint16_t count) {
+    int status = PWM_ERR_EMERGENCY;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
 
-    switch (channel) {
-        case TIM_CHANNEL_1: htim1.Instance->CCR1 = count; break;
-        case TIM_CHANNEL_2: htim1.Instance->CCR2 = count; break;
-        case TIM_CHANNEL_3: htim1.Instance->CCR3 = count; break;
-        default: break;
+    if (!emergency) {
+        *channels[id].ccr = count;
+        status = 0;
     }
 
+    __set_PRIMASK(primask);
+    return status;
+}
+
+
+/*!
+ *  @brief Modifier le cycle de travail d'un actionneur, sans envoyer le frame de TIM1
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @param count Valeur du compteur (0 à l'ARR du timer, PWM_MAX par défaut)
+ *  @return Code d'erreur
+ *
+ *  Pour changer plusieurs channels de TIM1 dans la même période avant un seul PWM_commit.
+ *  Les channels des autres timers sont écrits directement dans leur CCR
+ */
+int PWM_stage_count(PWM_Id id, uint16_t count) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+    if (count < PWM_MIN) return PWM_ERR_COUNT_TOO_LOW;
+    if (count > channels[id].timer->Instance->ARR) return PWM_ERR_COUNT_TOO_HIGH;
+
+    return PWM_stage(id, count);
+}
+
+
+/*!
+ *  @brief Convertir un cycle de travail Q15 en valeur de compteur
+ *  @param id L'actionneur (déjà vérifié)
+ *  @param duty Cycle de travail (Q15, 0 à PWM_Q15_ONE)
+ *  @return La valeur du compteur
+ *
+ *  L'échelle est l'ARR courant (suit PWM_configure) : une multiplication et un décalage
+ */
+static uint16_t PWM_q15_to_count(PWM_Id id, uint16_t duty) {
+    uint32_t arr = channels[id].timer->Instance->ARR;
+    uint32_t count = (duty * (arr + 1)) >> 15;
+
+    return count > arr ? arr : count;
+}
+
+
+/*!
+ *  @brief Modifier le cycle de travail Q15 d'un actionneur, sans envoyer le frame de TIM1
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @param duty Cycle de travail (Q15, 0 à PWM_Q15_ONE)
+ *  @return Code d'erreur
+ */
+int PWM_stage_q15(PWM_Id id, uint16_t duty) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+    if (duty > PWM_Q15_ONE) return PWM_ERR_DUTY_CYCLE_TOO_HIGH;
+
+    return PWM_stage(id, PWM_q15_to_count(id, duty));
+}
+
+
+/*!
+ *  @brief Convertir une largeur d'impulsion en valeur de compteur
+ *  @param id L'actionneur (déjà vérifié)
+ *  @param us Largeur d'impulsion (µs)
+ *  @return La valeur du compteur, arrondie
+ *
+ *  L'échelle est le PSC courant (suit PWM_configure) : la largeur reste la même quand
+ *  la fréquence du timer change, ce qu'attend un servo
+ */
+static uint32_t PWM_us_to_count(PWM_Id id, uint16_t us) {
+    TIM_TypeDef *tim = channels[id].timer->Instance;
+    uint64_t tick = (uint64_t) (tim->PSC + 1) * 1000000;
+
+    return (uint32_t) (((uint64_t) us * PWM_timer_clock(tim) + tick/2) / tick);
+}
+
+
+/*!
+ *  @brief Modifier la largeur d'impulsion d'un actionneur, sans envoyer le frame de TIM1
+ *  @param id L'actionneur (PWM_SERVO_BASKET, ...)
+ *  @param us Largeur d'impulsion (µs, SERVO_MIN_US à SERVO_MAX_US pour les servos)
+ *  @return Code d'erreur
+ */
+int PWM_stage_us(PWM_Id id, uint16_t us) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+
+    uint32_t count = PWM_us_to_count(id, us);
+    if (count > channels[id].timer->Instance->ARR) return PWM_ERR_COUNT_TOO_HIGH;
+
+    return PWM_stage(id, count);
+}
+
+
+/*!
+ *  @brief Couper un actionneur tout de suite, sans attendre l'update event
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @return Code d'erreur
+ *
+ *  Pour les arrêts urgents (interruption de la FIFO1 du CAN) : le preload du channel
+ *  est coupé le temps d'écrire son CCR, la sortie passe à 0 en quelques cycles au lieu
+ *  d'une période. Le frame et la copie du DMA sont mis à 0 pour qu'un burst en attente
+ *  ne rallume pas la sortie
+ */
+int PWM_force_off(PWM_Id id) {
+    if (id >= PWM_CHANNEL_COUNT) return PWM_ERR_CHANNEL;
+
+    const PWM_Channel *c = &channels[id];
+    TIM_TypeDef *tim = c->timer->Instance;
+
+    *c->ccr = 0;
+    if (c->burst)
+        dma_frame[c->ccr - frame] = 0;
+
+    // OC1PE/OC3PE (bit 3) ou OC2PE/OC4PE (bit 11) de CCMR1/CCMR2
+    volatile uint32_t *ccmr = (c->channel == TIM_CHANNEL_1 || c->channel == TIM_CHANNEL_2)
+        ? &tim->CCMR1 : &tim->CCMR2;
+    uint32_t preload = (c->channel == TIM_CHANNEL_1 || c->channel == TIM_CHANNEL_3)
+        ? TIM_CCMR1_OC1PE : TIM_CCMR1_OC2PE;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *ccmr &= ~preload;
+    __HAL_TIM_SET_COMPARE(c->timer, c->channel, 0);
+    *ccmr |= preload;
+    __set_PRIMASK(primask);
+
     return 0;
 }
 
 
+/*!
+ *  @brief Arrêt d'urgence : couper tous les actionneurs tout de suite
+ *
+ *  Les valeurs suivantes (commandes, séquences, scripts) sont refusées avec
+ *  PWM_ERR_EMERGENCY jusqu'à PWM_emergency_clear (code CAN FCT_REPRISE_URGENCE)
+ */
+void PWM_emergency_stop(void) {
+    emergency = 1;
+
+    for (uint8_t i = 0; i < PWM_CHANNEL_COUNT; i++)
+        PWM_force_off(i);
+}
+
+
+/*!
+ *  @brief Fin de l'arrêt d'urgence, les actionneurs restent à 0 jusqu'à la prochaine valeur
+ */
+void PWM_emergency_clear(void) {
+    emergency = 0;
+}
+
+
+/*!
+ *  @brief Lire la dernière valeur du compteur demandée pour un actionneur
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @return Valeur du compteur (celle du frame pour TIM1, même si pas encore envoyée)
+ */
+uint16_t PWM_get_count(PWM_Id id) {
+    if (id >= PWM_CHANNEL_COUNT) return 0;
+
+    return *channels[id].ccr;
+}
+
+
+/*!
+ *  @brief Envoyer le frame : CCR1 à CCR4 sont chargés ensemble au prochain update event
+ *  @return Code d'erreur
+ *
+ *  Le DMA écrit les 4 registres juste après l'update event, le preload des CCR les
+ *  applique tous à la période suivante : un changement de plusieurs channels ne
+ *  peut plus être coupé entre deux périodes. Aucun travail du CPU quand rien ne change.
+ *  Refusé (PWM_ERR_EMERGENCY) pendant un arrêt d'urgence
+ */
+int PWM_commit(void) {
+    int status = 0;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (emergency)
+        status = PWM_ERR_EMERGENCY;
+    else if (frame_busy)
+        frame_pending = 1;  // Un burst attend déjà l'update event : le frame partira juste après
+    else
+        status = PWM_frame_start();
+
+    __set_PRIMASK(primask);
+    return status;
+}
+
+
+/*!
+ *  @brief Définir directement le cycle de travail du PWM
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @param count Valeur du compteur (0 à l'ARR du timer, PWM_MAX par défaut)
+ *  @return Code d'erreur
+ */
+int PWM_set_count(PWM_Id id, uint16_t count) {
+    int status = PWM_stage_count(id, count);
+    if (status != 0 || !channels[id].burst)
+        return status;
+
+    return PWM_commit();
+}
+
+
+/*!
+ *  @brief Définir le cycle de travail du PWM en Q15, sans calcul flottant
+ *  @param id L'actionneur (PWM_TURBINE, ...)
+ *  @param duty Cycle de travail (Q15, 0 à PWM_Q15_ONE)
+ *  @return Code d'erreur
+ */
+int PWM_set_q15(PWM_Id id, uint16_t duty) {
+    int status = PWM_stage_q15(id, duty);
+    if (status != 0 || !channels[id].burst)
+        return status;
+
+    return PWM_commit();
+}
+
+
+/*!
+ *  @brief Définir la largeur d'impulsion du PWM, indépendante de la fréquence du timer
+ *  @param id L'actionneur (PWM_SERVO_BASKET, ...)
+ *  @param us Largeur d'impulsion (µs)
+ *  @return Code d'erreur
+ */
+int PWM_set_us(PWM_Id id, uint16_t us) {
+    int status = PWM_stage_us(id, us);
+    if (status != 0 || !channels[id].burst)
+        return status;
+
+    return PWM_commit();
+}
+
+
 /*!
  *  @brief Définir le cycle de travail du PWM en pourcentage
- *  @param timer Généralement &htim1 (structure d'STM du timer configuré)
+ *  @param id L'actionneur (PWM_TURBINE, ...)
  *  @param duty_cycle Cycle de travail (0 à 1)
  *  @return Code d'erreur
  */
-int PWM_set_cycle(uint32_t channel, float duty_cycle) {
+int PWM_set_cycle(PWM_Id id, float duty_cycle) {
     if (duty_cycle < 0) return PWM_ERR_DUTY_CYCLE_TOO_LOW;
     if (duty_cycle > 1) return PWM_ERR_DUTY_CYCLE_TOO_HIGH;
 
-    return PWM_set_count(channel, (uint16_t) (duty_cycle * PWM_MAX));
+    return PWM_set_q15(id, (uint16_t) (duty_cycle * PWM_Q15_ONE));
 }
@@ -0,0 +1,416 @@
+/*!
+ *  @version 1.0
+ *  @file    pwm_script.c
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Interpréteur de scripts d'actionneurs stockés dans une page de flash
+ */
+
+#include <string.h>
+#include "pwm_script.h"
+
+#define PWM_RUN_IDLE                0
+#define PWM_RUN_EXEC                1
+#define PWM_RUN_WAIT                2
+#define PWM_RUN_RAMP                3
+#define PWM_RUN_EVENT               4
+
+#define PWM_UPLOAD_IDLE             0
+#define PWM_UPLOAD_RECEIVING        1
+#define PWM_UPLOAD_READY            2
+
+#define PWM_SCRIPT_HEADER           ((const PWM_ScriptHeader *) PWM_SCRIPT_ADDR)
+#define PWM_SCRIPT_CODE             ((const uint8_t *) PWM_SCRIPT_ADDR + sizeof(PWM_ScriptHeader))
+
+
+static PWM_ScriptRunner runners[PWM_SCRIPT_RUNNERS];
+static uint8_t page_valid = 0;
+
+// Demandes des interruptions, traitées par PWM_script_run
+static volatile uint32_t start_requests = 0;
+static volatile uint32_t stop_requests = 0;
+static volatile uint8_t events = 0;
+
+// Page reçue par CAN, écrite en flash par PWM_script_run
+static uint64_t upload_page[PWM_SCRIPT_PAGE_SIZE / 8];
+static volatile uint8_t upload_state = PWM_UPLOAD_IDLE;
+
+// Taille de chaque instruction (opcode compris)
+static const uint8_t op_size[] = {
+    [PWM_OP_END]   = 1,
+    [PWM_OP_SET]   = 4,
+    [PWM_OP_RAMP]  = 6,
+    [PWM_OP_WAIT]  = 3,
+    [PWM_OP_EVENT] = 2,
+    [PWM_OP_LOOP]  = 4,
+};
+
+
+/*!
+ *  @brief Vérifier une page de scripts (entête, offsets et somme du bytecode)
+ *  @param page La page à vérifier (flash ou page reçue)
+ *  @return 1 si la page est valide, 0 sinon
+ */
+static int PWM_script_check(const uint8_t *page) {
+    const PWM_ScriptHeader *header = (const PWM_ScriptHeader *) page;
+    const uint8_t *code = page + sizeof(PWM_ScriptHeader);
+
+    if (header->magic != PWM_SCRIPT_MAGIC) return 0;
+    if (header->size > PWM_SCRIPT_PAGE_SIZE - sizeof(PWM_ScriptHeader)) return 0;
+
+    for (uint8_t i = 0; i < PWM_SCRIPT_MAX; i++)
+        if (header->offset[i] != PWM_SCRIPT_NONE && header->offset[i] >= header->size)
+            return 0;
+
+    uint16_t sum = 0;
+    for (uint16_t i = 0; i < header->size; i++)
+        sum += code[i];
+
+    return sum == header->checksum;
+}
+
+
+/*!
+ *  @brief Lire un mot de 16 bits du bytecode (little endian)
+ *  @param p Le premier octet
+ *  @return La valeur lue
+ */
+static uint16_t PWM_script_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+/*!
+ *  @brief Demander l'exécution d'un script de la page
+ *  @param script Le numéro du script (0 à PWM_SCRIPT_MAX - 1)
+ *  @return Code d'erreur (PWM_ERR_SCRIPT_ABSENT si la page ne le contient pas)
+ *
+ *  Utilisable depuis une interruption : le script démarre au prochain PWM_script_run.
+ *  Relancer un script en cours le reprend du début
+ */
+int PWM_script_start(uint8_t script) {
+    if (script >= PWM_SCRIPT_MAX) return PWM_ERR_SCRIPT_ABSENT;
+    if (!page_valid || upload_state == PWM_UPLOAD_READY) return PWM_ERR_SCRIPT_INVALID;
+    if (PWM_SCRIPT_HEADER->offset[script] == PWM_SCRIPT_NONE) return PWM_ERR_SCRIPT_ABSENT;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    start_requests |= 1UL << script;
+    stop_requests &= ~(1UL << script);
+    __set_PRIMASK(primask);
+
+    return 0;
+}
+
+
+/*!
+ *  @brief Arrêter un script (les actionneurs gardent leur dernière valeur)
+ *  @param script Le numéro du script
+ */
+void PWM_script_stop(uint8_t script) {
+    if (script >= PWM_SCRIPT_MAX) return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    stop_requests |= 1UL << script;
+    start_requests &= ~(1UL << script);
+    __set_PRIMASK(primask);
+}
+
+
+/*!
+ *  @brief Signaler des événements aux scripts qui les attendent (PWM_OP_EVENT)
+ *  @param mask Les événements (un bit par événement)
+ */
+void PWM_script_event(uint8_t mask) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    events |= mask;
+    __set_PRIMASK(primask);
+}
+
+
+/*!
+ *  @brief Savoir si la page peut être effacée sans risque
+ *  @return 1 si aucun script ne tourne et tous les actionneurs sont à 0, 0 sinon
+ *
+ *  L'effacement bloque le CPU et toutes les interruptions, y compris l'arrêt
+ *  d'urgence de la FIFO1 : il n'est fait qu'avec les actionneurs arrêtés
+ */
+static int PWM_script_idle(void) {
+    for (uint8_t i = 0; i < PWM_SCRIPT_RUNNERS; i++)
+        if (runners[i].state != PWM_RUN_IDLE)
+            return 0;
+
+    for (uint8_t id = 0; id < PWM_CHANNEL_COUNT; id++)
+        if (PWM_get_count(id) != 0)
+            return 0;
+
+    return 1;
+}
+
+
+/*!
+ *  @brief Recevoir une trame d'envoi de la page de scripts
+ *  @param data Les données de la trame CAN
+ *  @param len La taille des données
+ *  @return Code d'erreur
+ *
+ *  - aucune donnée : début d'envoi, la page reçue est remise à 0xFF
+ *  - offset16 + 1 à 6 octets : octets de la page à partir de offset
+ *  - offset16 = 0xFFFF seul : fin d'envoi, la page est vérifiée puis écrite par PWM_script_run.
+ *    Refusée (PWM_ERR_SCRIPT_BUSY) tant qu'un actionneur est actif, elle peut être renvoyée
+ */
+int PWM_script_upload(const uint8_t data[], uint8_t len) {
+    if (upload_state == PWM_UPLOAD_READY) return PWM_ERR_SCRIPT_UPLOAD;
+
+    if (len == 0) {
+        memset(upload_page, 0xff, sizeof(upload_page));
+        upload_state = PWM_UPLOAD_RECEIVING;
+        return 0;
+    }
+
+    if (upload_state != PWM_UPLOAD_RECEIVING || len < 2) return PWM_ERR_SCRIPT_UPLOAD;
+
+    uint16_t offset = PWM_script_u16(data);
+    if (len == 2 && offset == 0xFFFF) {
+        if (!PWM_script_idle()) return PWM_ERR_SCRIPT_BUSY;
+        upload_state = PWM_UPLOAD_READY;
+        return 0;
+    }
+
+    if (offset + len - 2 > PWM_SCRIPT_PAGE_SIZE) return PWM_ERR_SCRIPT_UPLOAD;
+
+    memcpy((uint8_t *) upload_page + offset, &data[2], len - 2);
+    return 0;
+}
+
+
+/*!
+ *  @brief Remplacer la page de scripts en flash par la page reçue
+ *  @return Code d'erreur
+ *
+ *  Le CPU et toutes les interruptions sont bloqués pendant l'effacement (environ 22ms,
+ *  cf. RM0394) : la page n'est écrite que si aucun actionneur n'est actif
+ */
+static int PWM_script_write(void) {
+    if (!PWM_script_check((const uint8_t *) upload_page)) return PWM_ERR_SCRIPT_INVALID;
+    if (!PWM_script_idle()) return PWM_ERR_SCRIPT_BUSY;
+
+    for (uint8_t i = 0; i < PWM_SCRIPT_RUNNERS; i++)
+        runners[i].state = PWM_RUN_IDLE;
+    page_valid = 0;
+
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_PAGES,
+        .Banks = FLASH_BANK_1,
+        .Page = (PWM_SCRIPT_ADDR - FLASH_BASE) / FLASH_PAGE_SIZE,
+        .NbPages = 1
+    };
+    uint32_t page_error;
+    int status = 0;
+
+    HAL_FLASH_Unlock();
+
+    if (HAL_FLASHEx_Erase(&erase, &page_error) != HAL_OK)
+        status = PWM_ERR_SCRIPT_FLASH;
+
+    // Programmation par double mot (64 bits), jusqu'à la fin du bytecode
+    uint32_t size = sizeof(PWM_ScriptHeader) + ((const PWM_ScriptHeader *) upload_page)->size;
+    for (uint32_t i = 0; status == 0 && i < (size + 7) / 8; i++)
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, PWM_SCRIPT_ADDR + i*8, upload_page[i]) != HAL_OK)
+            status = PWM_ERR_SCRIPT_FLASH;
+
+    HAL_FLASH_Lock();
+
+    page_valid = PWM_script_check((const uint8_t *) PWM_SCRIPT_ADDR);
+    return status;
+}
+
+
+/*!
+ *  @brief Préparer l'exécution d'un script au début
+ *  @param runner L'emplacement d'exécution
+ *  @param script Le numéro du script
+ */
+static void PWM_script_load(PWM_ScriptRunner *runner, uint8_t script) {
+    runner->script = script;
+    runner->base = PWM_SCRIPT_HEADER->offset[script];
+    runner->pc = runner->base;
+    runner->loop_left = 0;
+    runner->state = PWM_RUN_EXEC;
+}
+
+
+/*!
+ *  @brief Modifier un actionneur seulement si sa valeur change
+ *  @param id L'actionneur
+ *  @param count Valeur du compteur
+ *  @return 1 si la valeur a été modifiée, 0 sinon
+ */
+static int PWM_script_set(uint8_t id, uint16_t count) {
+    if (id >= PWM_CHANNEL_COUNT || PWM_get_count(id) == count)
+        return 0;
+
+    return PWM_stage_count(id, count) == 0;
+}
+
+
+/*!
+ *  @brief Avancer un script jusqu'à sa prochaine attente
+ *  @param r Le script en cours
+ *  @param now HAL_GetTick()
+ *  @return 1 si une valeur du frame de TIM1 a été modifiée, 0 sinon
+ */
+static int PWM_script_step(PWM_ScriptRunner *r, uint32_t now) {
+    const uint8_t *code = PWM_SCRIPT_CODE;
+    uint16_t size = PWM_SCRIPT_HEADER->size;
+    uint32_t elapsed = now - r->start;
+    int staged = 0;
+
+    switch (r->state) {
+        case PWM_RUN_WAIT:
+            if (elapsed < r->duration) return 0;
+            break;
+        case PWM_RUN_RAMP:
+            if (elapsed < r->duration) {
+                int32_t delta = (int32_t) r->ramp_to - r->ramp_from;
+                return PWM_script_set(r->ramp_id, r->ramp_from + delta * (int32_t) elapsed / r->duration);
+            }
+            staged = PWM_script_set(r->ramp_id, r->ramp_to);
+            break;
+        case PWM_RUN_EVENT: {
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            uint8_t caught = events & r->event_mask;
+            events &= ~caught;
+            __set_PRIMASK(primask);
+
+            if (!caught) return 0;
+            break;
+        }
+        default:
+            break;
+    }
+
+    r->state = PWM_RUN_EXEC;
+
+    for (uint8_t budget = 0; budget < PWM_SCRIPT_BUDGET; budget++) {
+        uint8_t op = r->pc < size ? code[r->pc] : PWM_OP_END;
+
+        // Opcode inconnu ou instruction coupée par la fin du bytecode
+        if (op >= sizeof(op_size) || r->pc + op_size[op] > size) op = PWM_OP_END;
+
+        const uint8_t *arg = &code[r->pc + 1];
+        r->pc += op_size[op];
+
+        switch (op) {
+            case PWM_OP_SET:
+                staged |= PWM_script_set(arg[0], PWM_script_u16(&arg[1]));
+                break;
+            case PWM_OP_RAMP:
+                if (arg[0] >= PWM_CHANNEL_COUNT) break;
+                r->ramp_id = arg[0];
+                r->ramp_from = PWM_get_count(arg[0]);
+                r->ramp_to = PWM_script_u16(&arg[1]);
+                r->duration = PWM_script_u16(&arg[3]);
+                r->start = now;
+                r->state = PWM_RUN_RAMP;
+                return staged;
+            case PWM_OP_WAIT:
+                r->duration = PWM_script_u16(arg);
+                r->start = now;
+                r->state = PWM_RUN_WAIT;
+                return staged;
+            case PWM_OP_EVENT:
+                r->event_mask = arg[0];
+                r->state = PWM_RUN_EVENT;
+                return staged;
+            case PWM_OP_LOOP:
+                if (arg[2] != 0) {
+                    if (r->loop_left == 0) r->loop_left = arg[2];
+                    if (--r->loop_left == 0) break;
+                }
+                r->pc = r->base + PWM_script_u16(arg);
+                break;
+            default:
+                r->state = PWM_RUN_IDLE;
+                return staged;
+        }
+    }
+
+    // Budget épuisé (boucle sans attente) : la suite au prochain appel
+    return staged;
+}
+
+
+/*!
+ *  @brief Vérifier la page de scripts en flash
+ *  @return Code d'erreur (PWM_ERR_SCRIPT_INVALID si aucune page valide n'est présente)
+ */
+int PWM_script_init(void) {
+    page_valid = PWM_script_check((const uint8_t *) PWM_SCRIPT_ADDR);
+    return page_valid ? 0 : PWM_ERR_SCRIPT_INVALID;
+}
+
+
+/*!
+ *  @brief Exécuter les scripts en cours, les demandes de démarrage et l'écriture de la page reçue
+ *  @note A appeler dans la boucle principale
+ *
+ *  Les valeurs de tous les scripts sont envoyées par un seul PWM_commit
+ */
+void PWM_script_run(void) {
+    if (upload_state == PWM_UPLOAD_READY) {
+        PWM_script_write();
+        upload_state = PWM_UPLOAD_IDLE;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t starts = start_requests;
+    uint32_t stops = stop_requests;
+    start_requests = 0;
+    stop_requests = 0;
+    __set_PRIMASK(primask);
+
+    if (!page_valid)
+        return;
+
+    for (uint8_t i = 0; i < PWM_SCRIPT_RUNNERS; i++) {
+        PWM_ScriptRunner *r = &runners[i];
+        if (r->state == PWM_RUN_IDLE)
+            continue;
+
+        // Arrêt, ou redémarrage d'un script déjà en cours
+        if (stops & (1UL << r->script))
+            r->state = PWM_RUN_IDLE;
+        else if (starts & (1UL << r->script)) {
+            PWM_script_load(r, r->script);
+            starts &= ~(1UL << r->script);
+        }
+    }
+
+    for (uint8_t script = 0; starts != 0 && script < PWM_SCRIPT_MAX; script++) {
+        if (!(starts & (1UL << script)))
+            continue;
+
+        starts &= ~(1UL << script);
+        for (uint8_t i = 0; i < PWM_SCRIPT_RUNNERS; i++) {
+            if (runners[i].state == PWM_RUN_IDLE) {
+                PWM_script_load(&runners[i], script);
+                break;
+            }
+        }
+    }
+
+    uint32_t now = HAL_GetTick();
+    int staged = 0;
+
+    for (uint8_t i = 0; i < PWM_SCRIPT_RUNNERS; i++)
+        if (runners[i].state != PWM_RUN_IDLE)
+            staged |= PWM_script_step(&runners[i], now);
+
+    if (staged)
+        PWM_commit();
+}
@@ -0,0 +1,140 @@
+/*!
+ *  @version 1.0
+ *  @file    pwm_sequence.c
+ *  @date    2026
+ *  @author  Julien PISTRE
+ *  @brief   Séquenceur d'actionneurs : étapes temporisées avancées par le SysTick
+ */
+
+#include "pwm_sequence.h"
+
+
+static PWM_Sequence slots[PWM_SEQ_SLOTS];
+
+
+/*!
+ *  @brief Lancer une séquence d'étapes
+ *  @param steps Les étapes (table constante, doit rester valide pendant la séquence)
+ *  @param length Le nombre d'étapes
+ *  @return Code d'erreur
+ *
+ *  Retourne immédiatement, utilisable depuis une interruption : les étapes sont
+ *  exécutées par PWM_sequence_tick. Relancer une séquence en cours la reprend du début
+ */
+int PWM_sequence_start(const PWM_Step steps[], uint8_t length) {
+    if (length == 0) return PWM_ERR_SEQ_EMPTY;
+
+    int status = PWM_ERR_SEQ_FULL;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    PWM_Sequence *slot = NULL;
+    for (uint8_t i = 0; i < PWM_SEQ_SLOTS; i++) {
+        if (slots[i].active && slots[i].steps == steps) {
+            slot = &slots[i];
+            break;
+        }
+
+        if (!slots[i].active && slot == NULL)
+            slot = &slots[i];
+    }
+
+    if (slot != NULL) {
+        slot->steps = steps;
+        slot->length = length;
+        slot->index = 0;
+        slot->wait_ms = 0;
+        slot->active = 1;
+        status = 0;
+    }
+
+    __set_PRIMASK(primask);
+    return status;
+}
+
+
+/*!
+ *  @brief Arrêter une séquence (les actionneurs gardent leur dernière valeur)
+ *  @param steps Les étapes de la séquence
+ */
+void PWM_sequence_stop(const PWM_Step steps[]) {
+    for (uint8_t i = 0; i < PWM_SEQ_SLOTS; i++)
+        if (slots[i].steps == steps)
+            slots[i].active = 0;
+}
+
+
+/*!
+ *  @brief Savoir si une séquence est en cours
+ *  @param steps Les étapes de la séquence
+ *  @return 1 si elle est en cours, 0 sinon
+ */
+int PWM_sequence_busy(const PWM_Step steps[]) {
+    for (uint8_t i = 0; i < PWM_SEQ_SLOTS; i++)
+        if (slots[i].active && slots[i].steps == steps)
+            return 1;
+
+    return 0;
+}
+
+
+/*!
+ *  @brief Exécuter les étapes d'une séquence jusqu'à la prochaine attente
+ *  @param seq La séquence
+ *  @return 1 si une valeur du frame de TIM1 a été modifiée, 0 sinon
+ */
+static int PWM_sequence_run(PWM_Sequence *seq) {
+    int staged = 0;
+
+    while (seq->index < seq->length) {
+        const PWM_Step *step = &seq->steps[seq->index++];
+
+        switch (step->type) {
+            case PWM_STEP_SET_COUNT:
+                staged |= PWM_stage_count(step->id, step->value) == 0;
+                break;
+            case PWM_STEP_SET_Q15:
+                staged |= PWM_stage_q15(step->id, step->value) == 0;
+                break;
+            case PWM_STEP_SET_US:
+                staged |= PWM_stage_us(step->id, step->value) == 0;
+                break;
+            case PWM_STEP_DELAY:
+                if (step->value > 0) {
+                    seq->wait_ms = step->value;
+                    return staged;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    seq->active = 0;
+    return staged;
+}
+
+
+/*!
+ *  @brief Avancer toutes les séquences en cours d'une milliseconde
+ *  @note A appeler toutes les millisecondes (SysTick_Handler)
+ *
+ *  Les valeurs de toutes les séquences sont envoyées par un seul PWM_commit
+ */
+void PWM_sequence_tick(void) {
+    int staged = 0;
+
+    for (uint8_t i = 0; i < PWM_SEQ_SLOTS; i++) {
+        PWM_Sequence *seq = &slots[i];
+        if (!seq->active)
+            continue;
+
+        if (seq->wait_ms > 0 && --seq->wait_ms > 0)
+            continue;
+
+        staged |= PWM_sequence_run(seq);
+    }
+
+    if (staged)
+        PWM_commit();
+}